@@ -62,6 +62,16 @@ struct msi_ec_fan_mode_conf {
 	struct msi_ec_mode modes[5]; // fixed size for easier hard coding
 };
 
+// Curve used by the advanced fan mode: fan speeds (percent) for
+// temperature breakpoints (celsius)
+struct msi_ec_fan_curve_conf {
+	int cpu_temp_address;  // first of MSI_EC_FAN_CURVE_TEMPS registers
+	int cpu_speed_address; // first of MSI_EC_FAN_CURVE_SPEEDS registers
+	int gpu_temp_address;
+	int gpu_speed_address;
+	int speed_max;         // highest accepted fan speed (percent)
+};
+
 struct msi_ec_cpu_conf {
 	int rt_temp_address;
 	int rt_fan_speed_address; // realtime
@@ -75,6 +85,9 @@ struct msi_ec_cpu_conf {
 struct msi_ec_gpu_conf {
 	int rt_temp_address;
 	int rt_fan_speed_address; // realtime
+	int bs_fan_speed_address; // basic
+	int bs_fan_speed_base_min;
+	int bs_fan_speed_base_max;
 };
 
 struct msi_ec_led_conf {
@@ -104,6 +117,7 @@ struct msi_ec_conf {
 	struct msi_ec_shift_mode_conf     shift_mode;
 	struct msi_ec_super_battery_conf  super_battery;
 	struct msi_ec_fan_mode_conf       fan_mode;
+	struct msi_ec_fan_curve_conf      fan_curve;
 	struct msi_ec_cpu_conf            cpu;
 	struct msi_ec_gpu_conf            gpu;
 	struct msi_ec_led_conf            leds;
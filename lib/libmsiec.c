@@ -0,0 +1,860 @@
+// Userspace access to the msi-ec driver, see libmsiec.h
+
+#define _GNU_SOURCE
+
+#include "libmsiec.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MSIEC_CHARDEV "/dev/msi-ec"
+#define MSIEC_SYSFS "/sys/devices/platform/msi-ec/"
+#define MSIEC_POWER_SUPPLY "/sys/class/power_supply/"
+
+#define MSIEC_PATH_LEN 256
+#define MSIEC_VALUE_LEN 64
+
+_Static_assert(MSI_EC_FIELD_COUNT <= 32, "snapshot valid mask too small");
+
+// ============================================================ //
+// Sysfs field table
+// ============================================================ //
+
+enum sysfs_format {
+	SYSFS_NUMBER,
+	SYSFS_ON_OFF,     // "on" is 1
+	SYSFS_LEFT_RIGHT, // "right" is 1
+	SYSFS_MODE,       // one of the labels
+};
+
+struct sysfs_field {
+	const char *name;      // as reported by the driver schema
+	const char *path;      // relative to MSIEC_SYSFS unless absolute
+	const char *available; // labels of SYSFS_MODE fields
+	enum sysfs_format format;
+	uint32_t unit;
+	uint32_t max;
+};
+
+#define SYSFS_FIELD(_id, _name, _path, _format, _unit, _max)		\
+	[_id] = {							\
+		.name = _name,						\
+		.path = _path,						\
+		.format = SYSFS_##_format,				\
+		.unit = MSI_EC_UNIT_##_unit,				\
+		.max = _max,						\
+	}
+
+#define SYSFS_MODE_FIELD(_id, _name, _available)			\
+	[_id] = {							\
+		.name = _name,						\
+		.path = _name,						\
+		.available = _available,				\
+		.format = SYSFS_MODE,					\
+		.unit = MSI_EC_UNIT_ENUM,				\
+	}
+
+static const struct sysfs_field sysfs_fields[MSI_EC_FIELD_COUNT] = {
+	SYSFS_FIELD(MSI_EC_FIELD_WEBCAM, "webcam",
+		    "webcam", ON_OFF, BOOL, 1),
+	SYSFS_FIELD(MSI_EC_FIELD_WEBCAM_BLOCK, "webcam_block",
+		    "webcam_block", ON_OFF, BOOL, 1),
+	SYSFS_FIELD(MSI_EC_FIELD_FN_WIN_SWAP, "fn_key",
+		    "fn_key", LEFT_RIGHT, BOOL, 1),
+	SYSFS_FIELD(MSI_EC_FIELD_COOLER_BOOST, "cooler_boost",
+		    "cooler_boost", ON_OFF, BOOL, 1),
+	SYSFS_MODE_FIELD(MSI_EC_FIELD_SHIFT_MODE, "shift_mode",
+			 "available_shift_modes"),
+	SYSFS_FIELD(MSI_EC_FIELD_SUPER_BATTERY, "super_battery",
+		    "super_battery", ON_OFF, BOOL, 1),
+	SYSFS_MODE_FIELD(MSI_EC_FIELD_FAN_MODE, "fan_mode",
+			 "available_fan_modes"),
+	// path resolved at open, the battery name varies
+	SYSFS_FIELD(MSI_EC_FIELD_CHARGE_END, "charge_control_end_threshold",
+		    NULL, NUMBER, PERCENT, 100),
+	SYSFS_FIELD(MSI_EC_FIELD_CPU_TEMP, "cpu/realtime_temperature",
+		    "cpu/realtime_temperature", NUMBER, CELSIUS, 255),
+	SYSFS_FIELD(MSI_EC_FIELD_CPU_FAN_SPEED, "cpu/realtime_fan_speed",
+		    "cpu/realtime_fan_speed", NUMBER, PERCENT, 100),
+	SYSFS_FIELD(MSI_EC_FIELD_CPU_BASIC_FAN_SPEED, "cpu/basic_fan_speed",
+		    "cpu/basic_fan_speed", NUMBER, PERCENT, 100),
+	SYSFS_FIELD(MSI_EC_FIELD_GPU_TEMP, "gpu/realtime_temperature",
+		    "gpu/realtime_temperature", NUMBER, CELSIUS, 255),
+	SYSFS_FIELD(MSI_EC_FIELD_GPU_FAN_SPEED, "gpu/realtime_fan_speed",
+		    "gpu/realtime_fan_speed", NUMBER, PERCENT, 100),
+	SYSFS_FIELD(MSI_EC_FIELD_MICMUTE_LED, "micmute_led",
+		    "/sys/class/leds/platform::micmute/brightness",
+		    NUMBER, BOOL, 1),
+	SYSFS_FIELD(MSI_EC_FIELD_MUTE_LED, "mute_led",
+		    "/sys/class/leds/platform::mute/brightness",
+		    NUMBER, BOOL, 1),
+	SYSFS_FIELD(MSI_EC_FIELD_KBD_BACKLIGHT, "kbd_backlight",
+		    "/sys/class/leds/msiacpi::kbd_backlight/brightness",
+		    NUMBER, LEVEL, 3),
+};
+
+// ============================================================ //
+// Handle
+// ============================================================ //
+
+struct msiec {
+	enum msiec_backend backend;
+	int fd; // chardev backend
+	char path[MSI_EC_FIELD_COUNT][MSIEC_PATH_LEN]; // sysfs backend
+	struct msi_ec_schema_field fields[MSI_EC_FIELD_COUNT];
+	// chardev backend, EC mode byte of every label index
+	uint32_t label_raw[MSI_EC_FIELD_COUNT][MSI_EC_SCHEMA_LABELS_MAX];
+
+	unsigned int cache_ms;
+	int cached;
+	struct msiec_snapshot cache;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int field_check(const struct msiec *handle, uint32_t id)
+{
+	if (id >= MSI_EC_FIELD_COUNT)
+		return -EINVAL;
+
+	if (!msiec_supported(handle, id))
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+// ============================================================ //
+// Sysfs backend
+// ============================================================ //
+
+static int sysfs_read(const char *path, char *buf, size_t size)
+{
+	ssize_t length;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	length = read(fd, buf, size - 1);
+	if (length < 0) {
+		length = -errno;
+		close(fd);
+		return length;
+	}
+	close(fd);
+
+	buf[length] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int sysfs_write(const char *path, const char *value)
+{
+	size_t length = strlen(value);
+	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	written = write(fd, value, length);
+	if (written < 0) {
+		written = -errno;
+		close(fd);
+		return written;
+	}
+	close(fd);
+
+	return (size_t)written == length ? 0 : -EIO;
+}
+
+static void sysfs_find_battery(char *path, size_t size)
+{
+	struct dirent *entry;
+	DIR *dir;
+
+	path[0] = '\0';
+
+	dir = opendir(MSIEC_POWER_SUPPLY);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "BAT", 3) != 0)
+			continue;
+
+		if (snprintf(path, size, MSIEC_POWER_SUPPLY "%s/%s",
+			     entry->d_name,
+			     sysfs_fields[MSI_EC_FIELD_CHARGE_END].name) <
+			    (int)size &&
+		    access(path, R_OK) == 0)
+			break;
+
+		path[0] = '\0';
+	}
+
+	closedir(dir);
+}
+
+// labels are numbered in their order, as in the chardev backend
+static void sysfs_load_labels(struct msi_ec_schema_field *desc,
+			      const char *path)
+{
+	char buf[MSI_EC_SCHEMA_LABELS_MAX * MSI_EC_SCHEMA_LABEL_LEN];
+	struct msi_ec_schema_label *label;
+	char *line, *save;
+	ssize_t length;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	length = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (length <= 0)
+		return;
+	buf[length] = '\0';
+
+	for (line = strtok_r(buf, "\n", &save);
+	     line && desc->label_count < MSI_EC_SCHEMA_LABELS_MAX;
+	     line = strtok_r(NULL, "\n", &save)) {
+		label = &desc->labels[desc->label_count];
+		label->value = desc->label_count++;
+		snprintf(label->name, sizeof(label->name), "%s", line);
+	}
+
+	if (desc->label_count)
+		desc->max = desc->label_count - 1;
+}
+
+static int sysfs_open(struct msiec *handle)
+{
+	const struct sysfs_field *sysfs;
+	struct msi_ec_schema_field *desc;
+	char available[MSIEC_PATH_LEN];
+
+	if (access(MSIEC_SYSFS, F_OK) < 0)
+		return -errno;
+
+	for (uint32_t id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+		sysfs = &sysfs_fields[id];
+		desc = &handle->fields[id];
+
+		desc->id = id;
+		desc->unit = sysfs->unit;
+		desc->scale = 1;
+		desc->max = sysfs->max;
+		snprintf(desc->name, sizeof(desc->name), "%s", sysfs->name);
+
+		if (!sysfs->path)
+			sysfs_find_battery(handle->path[id], MSIEC_PATH_LEN);
+		else if (sysfs->path[0] == '/')
+			snprintf(handle->path[id], MSIEC_PATH_LEN, "%s",
+				 sysfs->path);
+		else
+			snprintf(handle->path[id], MSIEC_PATH_LEN,
+				 MSIEC_SYSFS "%s", sysfs->path);
+
+		if (!handle->path[id][0] || access(handle->path[id], R_OK) < 0)
+			continue;
+
+		desc->flags = MSI_EC_SCHEMA_FIELD_SUPPORTED;
+		if (access(handle->path[id], W_OK) == 0)
+			desc->flags |= MSI_EC_SCHEMA_FIELD_WRITABLE;
+
+		if (sysfs->format == SYSFS_MODE) {
+			snprintf(available, sizeof(available),
+				 MSIEC_SYSFS "%s", sysfs->available);
+			sysfs_load_labels(desc, available);
+		}
+	}
+
+	return 0;
+}
+
+static int sysfs_get(const struct msiec *handle, uint32_t id, uint32_t *value)
+{
+	const struct msi_ec_schema_field *desc = &handle->fields[id];
+	char buf[MSIEC_VALUE_LEN];
+	char *end;
+	int result;
+
+	result = sysfs_read(handle->path[id], buf, sizeof(buf));
+	if (result < 0)
+		return result;
+
+	switch (sysfs_fields[id].format) {
+	case SYSFS_NUMBER:
+		errno = 0;
+		*value = strtoul(buf, &end, 10);
+		if (errno || end == buf)
+			return -EIO;
+		return 0;
+	case SYSFS_ON_OFF:
+		if (strcmp(buf, "on") && strcmp(buf, "off"))
+			return -EIO;
+		*value = strcmp(buf, "on") == 0;
+		return 0;
+	case SYSFS_LEFT_RIGHT:
+		if (strcmp(buf, "right") && strcmp(buf, "left"))
+			return -EIO;
+		*value = strcmp(buf, "right") == 0;
+		return 0;
+	case SYSFS_MODE:
+		for (uint32_t i = 0; i < desc->label_count; i++) {
+			if (strcmp(buf, desc->labels[i].name) == 0) {
+				*value = desc->labels[i].value;
+				return 0;
+			}
+		}
+		return -ENODATA; // e.g. "unknown"
+	}
+
+	return -EINVAL;
+}
+
+static int sysfs_format(const struct msiec *handle, uint32_t id,
+			uint32_t value, char *buf, size_t size)
+{
+	const struct msi_ec_schema_field *desc = &handle->fields[id];
+
+	if (!(desc->flags & MSI_EC_SCHEMA_FIELD_WRITABLE))
+		return -EACCES;
+
+	if (value < desc->min || value > desc->max)
+		return -EINVAL;
+
+	switch (sysfs_fields[id].format) {
+	case SYSFS_NUMBER:
+		snprintf(buf, size, "%u", value);
+		return 0;
+	case SYSFS_ON_OFF:
+		snprintf(buf, size, "%s", value ? "on" : "off");
+		return 0;
+	case SYSFS_LEFT_RIGHT:
+		snprintf(buf, size, "%s", value ? "right" : "left");
+		return 0;
+	case SYSFS_MODE:
+		if (value >= desc->label_count)
+			return -EINVAL;
+		snprintf(buf, size, "%s", desc->labels[value].name);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int sysfs_set(const struct msiec *handle,
+		     const struct msi_ec_field_value *values,
+		     unsigned int count, unsigned int *applied)
+{
+	char buf[MSIEC_VALUE_LEN];
+	int result;
+
+	// validate everything first, as the driver does
+	for (unsigned int i = 0; i < count; i++) {
+		result = sysfs_format(handle, values[i].id, values[i].value,
+				      buf, sizeof(buf));
+		if (result < 0)
+			return result;
+	}
+
+	for (; *applied < count; (*applied)++) {
+		sysfs_format(handle, values[*applied].id,
+			     values[*applied].value, buf, sizeof(buf));
+
+		result = sysfs_write(handle->path[values[*applied].id], buf);
+		if (result < 0)
+			return result;
+	}
+
+	return 0;
+}
+
+// ============================================================ //
+// Chardev backend
+// ============================================================ //
+
+static int chardev_open(struct msiec *handle)
+{
+	struct msi_ec_schema schema = {
+		.field_count = MSI_EC_FIELD_COUNT,
+		.fields = (uintptr_t)handle->fields,
+	};
+	uint32_t version;
+	int writable = 1;
+
+	handle->fd = open(MSIEC_CHARDEV, O_RDWR | O_CLOEXEC);
+	if (handle->fd < 0 && errno == EACCES) {
+		writable = 0;
+		handle->fd = open(MSIEC_CHARDEV, O_RDONLY | O_CLOEXEC);
+	}
+	if (handle->fd < 0)
+		return -errno;
+
+	// older drivers only stream samples
+	if (ioctl(handle->fd, MSI_EC_IOC_GET_VERSION, &version) < 0 ||
+	    version != MSI_EC_IOC_VERSION ||
+	    ioctl(handle->fd, MSI_EC_IOC_GET_SCHEMA, &schema) < 0) {
+		close(handle->fd);
+		handle->fd = -1;
+		return -EPROTONOSUPPORT;
+	}
+
+	for (uint32_t id = 0; id < MSI_EC_FIELD_COUNT && !writable; id++)
+		handle->fields[id].flags &= ~MSI_EC_SCHEMA_FIELD_WRITABLE;
+
+	// enum values are exchanged as label indexes, as with sysfs
+	for (uint32_t id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+		struct msi_ec_schema_field *desc = &handle->fields[id];
+
+		if (desc->unit != MSI_EC_UNIT_ENUM)
+			continue;
+
+		for (uint32_t i = 0; i < desc->label_count; i++) {
+			handle->label_raw[id][i] = desc->labels[i].value;
+			desc->labels[i].value = i;
+		}
+
+		desc->min = 0;
+		desc->max = desc->label_count ? desc->label_count - 1 : 0;
+	}
+
+	return 0;
+}
+
+// label index of an EC mode byte
+static int chardev_label_index(const struct msiec *handle, uint32_t id,
+			       uint32_t raw, uint32_t *index)
+{
+	for (uint32_t i = 0; i < handle->fields[id].label_count; i++) {
+		if (handle->label_raw[id][i] == raw) {
+			*index = i;
+			return 0;
+		}
+	}
+
+	return -ENODATA; // as sysfs reports "unknown"
+}
+
+static int chardev_get(const struct msiec *handle,
+		       struct msi_ec_field_value *values, unsigned int count)
+{
+	struct msi_ec_fields req = {
+		.count = count,
+		.values = (uintptr_t)values,
+	};
+
+	if (ioctl(handle->fd, MSI_EC_IOC_GET_FIELDS, &req) < 0)
+		return -errno;
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint32_t id = values[i].id;
+
+		if (values[i].error < 0 ||
+		    handle->fields[id].unit != MSI_EC_UNIT_ENUM)
+			continue;
+
+		values[i].error = chardev_label_index(handle, id,
+						      values[i].value,
+						      &values[i].value);
+	}
+
+	return 0;
+}
+
+static int chardev_set(const struct msiec *handle,
+		       const struct msi_ec_field_value *values,
+		       unsigned int count, unsigned int *applied)
+{
+	struct msi_ec_field_value raw[MSI_EC_IOC_FIELDS_MAX];
+	struct msi_ec_fields req = {
+		.count = count,
+		.values = (uintptr_t)raw,
+	};
+	int result = 0;
+
+	memcpy(raw, values, count * sizeof(*values));
+	for (unsigned int i = 0; i < count; i++) {
+		const struct msi_ec_schema_field *desc = &handle->fields[raw[i].id];
+
+		if (desc->unit != MSI_EC_UNIT_ENUM)
+			continue;
+
+		if (raw[i].value >= desc->label_count)
+			return -EINVAL;
+		raw[i].value = handle->label_raw[raw[i].id][raw[i].value];
+	}
+
+	if (ioctl(handle->fd, MSI_EC_IOC_SET_FIELDS, &req) < 0)
+		result = -errno;
+
+	*applied = req.count;
+	return result;
+}
+
+// ============================================================ //
+// Public interface
+// ============================================================ //
+
+struct msiec *msiec_open(enum msiec_backend backend)
+{
+	struct msiec *handle;
+	int result = -ENODEV;
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle)
+		return NULL;
+	handle->fd = -1;
+
+	if (backend == MSIEC_BACKEND_AUTO || backend == MSIEC_BACKEND_CHARDEV) {
+		result = chardev_open(handle);
+		if (result == 0)
+			handle->backend = MSIEC_BACKEND_CHARDEV;
+	}
+
+	if (handle->backend == MSIEC_BACKEND_AUTO &&
+	    (backend == MSIEC_BACKEND_AUTO || backend == MSIEC_BACKEND_SYSFS)) {
+		memset(handle->fields, 0, sizeof(handle->fields));
+		result = sysfs_open(handle);
+		if (result == 0)
+			handle->backend = MSIEC_BACKEND_SYSFS;
+	}
+
+	if (handle->backend == MSIEC_BACKEND_AUTO) {
+		free(handle);
+		errno = -result;
+		return NULL;
+	}
+
+	return handle;
+}
+
+void msiec_close(struct msiec *handle)
+{
+	if (!handle)
+		return;
+
+	if (handle->fd >= 0)
+		close(handle->fd);
+	free(handle);
+}
+
+enum msiec_backend msiec_backend(const struct msiec *handle)
+{
+	return handle->backend;
+}
+
+const char *msiec_backend_name(enum msiec_backend backend)
+{
+	switch (backend) {
+	case MSIEC_BACKEND_AUTO:
+		return "auto";
+	case MSIEC_BACKEND_CHARDEV:
+		return "chardev";
+	case MSIEC_BACKEND_SYSFS:
+		return "sysfs";
+	}
+
+	return "unknown";
+}
+
+const struct msi_ec_schema_field *msiec_field(const struct msiec *handle,
+					      uint32_t id)
+{
+	if (id >= MSI_EC_FIELD_COUNT)
+		return NULL;
+
+	return &handle->fields[id];
+}
+
+int msiec_supported(const struct msiec *handle, uint32_t id)
+{
+	return id < MSI_EC_FIELD_COUNT &&
+	       (handle->fields[id].flags & MSI_EC_SCHEMA_FIELD_SUPPORTED);
+}
+
+int msiec_label_value(const struct msiec *handle, uint32_t id,
+		      const char *label, uint32_t *value)
+{
+	const struct msi_ec_schema_field *desc = msiec_field(handle, id);
+
+	if (!desc)
+		return -EINVAL;
+
+	for (uint32_t i = 0; i < desc->label_count; i++) {
+		if (strcmp(desc->labels[i].name, label) == 0) {
+			*value = desc->labels[i].value;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void msiec_set_cache(struct msiec *handle, unsigned int cache_ms)
+{
+	handle->cache_ms = cache_ms;
+	handle->cached = 0;
+}
+
+// fills the error of every value, fails only when the backend does
+static int fields_get(const struct msiec *handle,
+		      struct msi_ec_field_value *values, unsigned int count)
+{
+	if (!count)
+		return 0;
+
+	if (handle->backend == MSIEC_BACKEND_CHARDEV)
+		return chardev_get(handle, values, count);
+
+	for (unsigned int i = 0; i < count; i++)
+		values[i].error = sysfs_get(handle, values[i].id,
+					    &values[i].value);
+
+	return 0;
+}
+
+static int snapshot_take(struct msiec *handle, struct msiec_snapshot *snapshot)
+{
+	struct msi_ec_field_value values[MSI_EC_FIELD_COUNT];
+	unsigned int count = 0;
+	int result;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+
+	for (uint32_t id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+		if (msiec_supported(handle, id))
+			values[count++].id = id;
+	}
+
+	result = fields_get(handle, values, count);
+	if (result < 0)
+		return result;
+
+	// fields that could not be read are left out
+	for (unsigned int i = 0; i < count; i++) {
+		if (values[i].error < 0)
+			continue;
+
+		snapshot->value[values[i].id] = values[i].value;
+		snapshot->valid |= 1U << values[i].id;
+	}
+
+	snapshot->timestamp_ns = now_ns();
+	return 0;
+}
+
+int msiec_snapshot(struct msiec *handle, struct msiec_snapshot *snapshot)
+{
+	int result;
+
+	if (handle->cache_ms && handle->cached &&
+	    now_ns() - handle->cache.timestamp_ns <
+		    (uint64_t)handle->cache_ms * 1000000) {
+		*snapshot = handle->cache;
+		return 0;
+	}
+
+	result = snapshot_take(handle, snapshot);
+	if (result < 0)
+		return result;
+
+	if (handle->cache_ms) {
+		handle->cache = *snapshot;
+		handle->cached = 1;
+	}
+
+	return 0;
+}
+
+int msiec_get(struct msiec *handle, struct msi_ec_field_value *values,
+	      unsigned int count)
+{
+	struct msiec_snapshot snapshot;
+	int result;
+
+	if (count > MSI_EC_IOC_FIELDS_MAX)
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count; i++) {
+		result = field_check(handle, values[i].id);
+		if (result < 0)
+			return result;
+	}
+
+	// a cached handle reads everything at once
+	if (handle->cache_ms) {
+		result = msiec_snapshot(handle, &snapshot);
+		if (result < 0)
+			return result;
+
+		for (unsigned int i = 0; i < count; i++) {
+			values[i].value = snapshot.value[values[i].id];
+			values[i].error =
+				snapshot.valid & (1U << values[i].id) ? 0 : -ENODATA;
+		}
+		return 0;
+	}
+
+	return fields_get(handle, values, count);
+}
+
+int msiec_set(struct msiec *handle, const struct msi_ec_field_value *values,
+	      unsigned int count, unsigned int *applied)
+{
+	unsigned int written = 0;
+	int result;
+
+	if (applied)
+		*applied = 0;
+
+	if (count > MSI_EC_IOC_FIELDS_MAX)
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count; i++) {
+		result = field_check(handle, values[i].id);
+		if (result < 0)
+			return result;
+	}
+
+	if (!count)
+		return 0;
+
+	handle->cached = 0;
+
+	if (handle->backend == MSIEC_BACKEND_CHARDEV)
+		result = chardev_set(handle, values, count, &written);
+	else
+		result = sysfs_set(handle, values, count, &written);
+
+	if (applied)
+		*applied = written;
+	return result;
+}
+
+// stream records carry EC mode bytes, 0xff when unknown as with sysfs
+static void sample_mode_index(const struct msiec *handle, uint32_t id,
+			      uint8_t *mode)
+{
+	uint32_t index;
+
+	*mode = chardev_label_index(handle, id, *mode, &index) == 0 ? index : 0xff;
+}
+
+static int subscribe_chardev(const struct msiec *handle, msiec_sample_cb cb,
+			     void *data)
+{
+	struct msi_ec_sample samples[16];
+	ssize_t length;
+	int result = 0;
+	int stop = 0;
+	int fd;
+
+	// a reader of its own starts at the newest record
+	fd = open(MSIEC_CHARDEV, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while (!stop) {
+		length = read(fd, samples, sizeof(samples));
+		if (length < 0) {
+			result = -errno;
+			break;
+		}
+
+		for (size_t i = 0; i < length / sizeof(samples[0]) && !stop; i++) {
+			sample_mode_index(handle, MSI_EC_FIELD_SHIFT_MODE,
+					  &samples[i].shift_mode);
+			sample_mode_index(handle, MSI_EC_FIELD_FAN_MODE,
+					  &samples[i].fan_mode);
+			stop = cb(&samples[i], data);
+		}
+	}
+
+	close(fd);
+	return result;
+}
+
+static const uint32_t sample_sensor_fields[MSI_EC_SENSOR_COUNT] = {
+	[MSI_EC_SENSOR_CPU_TEMP] = MSI_EC_FIELD_CPU_TEMP,
+	[MSI_EC_SENSOR_CPU_FAN]  = MSI_EC_FIELD_CPU_FAN_SPEED,
+	[MSI_EC_SENSOR_GPU_TEMP] = MSI_EC_FIELD_GPU_TEMP,
+	[MSI_EC_SENSOR_GPU_FAN]  = MSI_EC_FIELD_GPU_FAN_SPEED,
+};
+
+static int subscribe_poll(struct msiec *handle, msiec_sample_cb cb,
+			  void *data, unsigned int interval_ms)
+{
+	struct timespec interval = {
+		.tv_sec = interval_ms / 1000,
+		.tv_nsec = (long)(interval_ms % 1000) * 1000000,
+	};
+	struct msiec_snapshot snapshot;
+	struct msi_ec_sample sample;
+	uint64_t seq = 0;
+	int result;
+
+	for (;;) {
+		result = snapshot_take(handle, &snapshot);
+		if (result < 0)
+			return result;
+
+		memset(&sample, 0, sizeof(sample));
+		sample.seq = seq++;
+		sample.timestamp_ns = snapshot.timestamp_ns;
+
+		for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+			uint32_t id = sample_sensor_fields[i];
+
+			if (snapshot.valid & (1U << id)) {
+				sample.value[i] = snapshot.value[id];
+				sample.valid |= 1U << i;
+			}
+		}
+		sample.shift_mode =
+			snapshot.valid & (1U << MSI_EC_FIELD_SHIFT_MODE) ?
+			snapshot.value[MSI_EC_FIELD_SHIFT_MODE] : 0xff;
+		sample.fan_mode =
+			snapshot.valid & (1U << MSI_EC_FIELD_FAN_MODE) ?
+			snapshot.value[MSI_EC_FIELD_FAN_MODE] : 0xff;
+		sample.cooler_boost = snapshot.value[MSI_EC_FIELD_COOLER_BOOST];
+
+		if (cb(&sample, data))
+			return 0;
+
+		if (nanosleep(&interval, NULL) < 0)
+			return -errno;
+	}
+}
+
+int msiec_subscribe(struct msiec *handle, msiec_sample_cb cb, void *data,
+		    unsigned int interval_ms)
+{
+	if (!cb)
+		return -EINVAL;
+
+	if (handle->backend == MSIEC_BACKEND_CHARDEV)
+		return subscribe_chardev(handle, cb, data);
+
+	if (!interval_ms)
+		return -EINVAL;
+
+	return subscribe_poll(handle, cb, data, interval_ms);
+}
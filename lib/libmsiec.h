@@ -0,0 +1,76 @@
+#ifndef __LIBMSIEC__
+#define __LIBMSIEC__
+
+// Userspace access to the msi-ec driver
+//
+// The fastest interface offered by the loaded driver is selected at open:
+// the /dev/msi-ec ioctls when available, then the per-attribute sysfs
+// files. Fields are addressed by enum msi_ec_field_id and described by the
+// same struct msi_ec_schema_field with both backends.
+//
+// The values of enum fields are the indexes of their labels with both
+// backends, sysfs only knowing the label names; the raw EC mode bytes
+// of the chardev are translated.
+//
+// Functions returning int return 0 or a negative errno value.
+
+#include <stdint.h>
+
+#include "../msi_ec_uapi.h"
+
+enum msiec_backend {
+	MSIEC_BACKEND_AUTO,
+	MSIEC_BACKEND_CHARDEV, // MSI_EC_IOC_* on /dev/msi-ec
+	MSIEC_BACKEND_SYSFS,   // /sys/devices/platform/msi-ec and friends
+};
+
+struct msiec;
+
+struct msiec_snapshot {
+	uint64_t timestamp_ns;               // CLOCK_MONOTONIC
+	uint32_t valid;                      // bitmask by field ID
+	uint32_t value[MSI_EC_FIELD_COUNT];
+};
+
+// Return nonzero to stop msiec_subscribe()
+typedef int (*msiec_sample_cb)(const struct msi_ec_sample *sample,
+			       void *data);
+
+// Returns NULL with errno set when the backend is not available
+struct msiec *msiec_open(enum msiec_backend backend);
+void msiec_close(struct msiec *handle);
+
+enum msiec_backend msiec_backend(const struct msiec *handle);
+const char *msiec_backend_name(enum msiec_backend backend);
+
+// NULL for unknown IDs
+const struct msi_ec_schema_field *msiec_field(const struct msiec *handle,
+					      uint32_t id);
+int msiec_supported(const struct msiec *handle, uint32_t id);
+int msiec_label_value(const struct msiec *handle, uint32_t id,
+		      const char *label, uint32_t *value);
+
+// Reads of the same handle are served from its last snapshot for up to
+// cache_ms, 0 (the default) disables caching. Sets invalidate the cache.
+void msiec_set_cache(struct msiec *handle, unsigned int cache_ms);
+
+// Every supported field, in one driver call with the chardev backend
+int msiec_snapshot(struct msiec *handle, struct msiec_snapshot *snapshot);
+
+// Sets the error of each value, a field that cannot be read does not fail
+// the others; only invalid IDs and backend failures are returned
+int msiec_get(struct msiec *handle, struct msi_ec_field_value *values,
+	      unsigned int count);
+
+// All the values are validated by the driver before the first write,
+// *applied (optional) is set to the number of values written
+int msiec_set(struct msiec *handle, const struct msi_ec_field_value *values,
+	      unsigned int count, unsigned int *applied);
+
+// Calls cb for every sampler record; the sysfs backend polls every
+// interval_ms instead and only fills the fields it can read. shift_mode
+// and fan_mode hold label indexes, 0xff when the mode is unknown
+int msiec_subscribe(struct msiec *handle, msiec_sample_cb cb, void *data,
+		    unsigned int interval_ms);
+
+#endif // __LIBMSIEC__
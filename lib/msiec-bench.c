@@ -0,0 +1,130 @@
+// Compares the cost of the driver interfaces through libmsiec
+//
+// Usage: msiec-bench [iterations]
+
+#include "libmsiec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *backend, const char *operation,
+		   unsigned int iterations, uint64_t elapsed_ns, int result)
+{
+	if (result < 0) {
+		printf("%-8s %-24s %s\n", backend, operation, strerror(-result));
+		return;
+	}
+
+	printf("%-8s %-24s %10.0f ns/op\n", backend, operation,
+	       (double)elapsed_ns / iterations);
+}
+
+static void bench_snapshot(struct msiec *handle, const char *operation,
+			   unsigned int iterations)
+{
+	struct msiec_snapshot snapshot;
+	uint64_t start = now_ns();
+	int result = 0;
+
+	for (unsigned int i = 0; i < iterations && result == 0; i++)
+		result = msiec_snapshot(handle, &snapshot);
+
+	report(msiec_backend_name(msiec_backend(handle)), operation,
+	       iterations, now_ns() - start, result);
+}
+
+static void bench_get(struct msiec *handle, const char *operation,
+		      uint32_t *ids, unsigned int count,
+		      unsigned int iterations)
+{
+	struct msi_ec_field_value values[MSI_EC_FIELD_COUNT];
+	uint64_t start;
+	int result = 0;
+
+	if (!count) {
+		report(msiec_backend_name(msiec_backend(handle)), operation,
+		       iterations, 0, -EOPNOTSUPP);
+		return;
+	}
+
+	start = now_ns();
+	for (unsigned int i = 0; i < iterations && result == 0; i++) {
+		for (unsigned int j = 0; j < count; j++)
+			values[j].id = ids[j];
+		result = msiec_get(handle, values, count);
+	}
+
+	report(msiec_backend_name(msiec_backend(handle)), operation,
+	       iterations, now_ns() - start, result);
+}
+
+static void bench_backend(enum msiec_backend backend, unsigned int iterations)
+{
+	static const uint32_t sensors[] = {
+		MSI_EC_FIELD_CPU_TEMP,
+		MSI_EC_FIELD_CPU_FAN_SPEED,
+		MSI_EC_FIELD_GPU_TEMP,
+		MSI_EC_FIELD_GPU_FAN_SPEED,
+		MSI_EC_FIELD_SHIFT_MODE,
+		MSI_EC_FIELD_FAN_MODE,
+	};
+	uint32_t ids[MSI_EC_FIELD_COUNT];
+	unsigned int count = 0;
+	struct msiec *handle;
+
+	handle = msiec_open(backend);
+	if (!handle) {
+		printf("%-8s %-24s %s\n", msiec_backend_name(backend),
+		       "open", strerror(errno));
+		return;
+	}
+
+	if (msiec_supported(handle, MSI_EC_FIELD_CPU_TEMP)) {
+		ids[0] = MSI_EC_FIELD_CPU_TEMP;
+		count = 1;
+	}
+	bench_get(handle, "get cpu temperature", ids, count, iterations);
+
+	count = 0;
+	for (size_t i = 0; i < sizeof(sensors) / sizeof(sensors[0]); i++) {
+		if (msiec_supported(handle, sensors[i]))
+			ids[count++] = sensors[i];
+	}
+	bench_get(handle, "get sensors and modes", ids, count, iterations);
+
+	bench_snapshot(handle, "snapshot", iterations);
+
+	msiec_set_cache(handle, 1000);
+	bench_snapshot(handle, "snapshot, 1 s cache", iterations);
+
+	msiec_close(handle);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 1000;
+
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 10);
+		if (!iterations) {
+			fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bench_backend(MSIEC_BACKEND_CHARDEV, iterations);
+	bench_backend(MSIEC_BACKEND_SYSFS, iterations);
+
+	return 0;
+}
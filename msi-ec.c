@@ -26,6 +26,11 @@
  * This driver also registers available led class devices for
  * mute, micmute and keyboard_backlight leds
  *
+ * Hotkeys handled by the EC firmware (webcam, cooler boost, shift mode)
+ * are reported through the "MSI EC hotkeys" input device
+ *
+ * Readings of the background sampler are streamed through /dev/msi-ec
+ *
  * This driver might not work on other laptops produced by MSI. Also, and until
  * future enhancements, no DMI data are used to identify your compatibility
  *
@@ -34,17 +39,50 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include "ec_memory_configuration.h"
+#include "msi_ec_uapi.h"
 
 #include <acpi/battery.h>
 #include <linux/acpi.h>
+#include <linux/bits.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/dmi.h>
+#include <linux/hrtimer.h>
+#include <linux/hwmon.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/init.h>
+#include <linux/int_sqrt.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/input.h>
+#include <linux/input/sparse-keymap.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/kernel.h>
+#include <linux/leds.h>
 #include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/perf_event.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/power_supply.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/string.h>
+#include <linux/tick.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
 
 static const char *const SM_ECO_NAME       = "eco";
 static const char *const SM_COMFORT_NAME   = "comfort";
@@ -107,6 +145,12 @@ static struct msi_ec_conf CONF0 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x6a needs testing
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x72 needs testing
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x82 needs testing
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x8a needs testing
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0x71,
@@ -119,6 +163,7 @@ static struct msi_ec_conf CONF0 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = 0x89,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -187,6 +232,12 @@ static struct msi_ec_conf CONF1 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x6a needs testing
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x72 needs testing
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x82 needs testing
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x8a needs testing
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0x71,
@@ -199,6 +250,7 @@ static struct msi_ec_conf CONF1 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = 0x89,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -265,6 +317,12 @@ static struct msi_ec_conf CONF2 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x6a needs testing
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x72 needs testing
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN, // 0x82 needs testing
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN, // 0x8a needs testing
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0x71,
@@ -277,6 +335,7 @@ static struct msi_ec_conf CONF2 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = 0x89,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = 0x2c,
@@ -344,6 +403,12 @@ static struct msi_ec_conf CONF3 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0xc9,
@@ -356,6 +421,7 @@ static struct msi_ec_conf CONF3 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = 0x89,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -421,6 +487,12 @@ static struct msi_ec_conf CONF4 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68, // needs testing
 		.rt_fan_speed_address  = 0x71, // needs testing
@@ -433,6 +505,7 @@ static struct msi_ec_conf CONF4 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNKNOWN,
@@ -500,6 +573,12 @@ static struct msi_ec_conf CONF5 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68, // needs testing
 		.rt_fan_speed_address  = 0x71, // needs testing
@@ -512,6 +591,7 @@ static struct msi_ec_conf CONF5 __initdata = {
 	.gpu = {
 		.rt_temp_address      = MSI_EC_ADDR_UNKNOWN,
 		.rt_fan_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = 0x2b,
@@ -579,6 +659,12 @@ static struct msi_ec_conf CONF6 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0xc9,
@@ -591,6 +677,7 @@ static struct msi_ec_conf CONF6 __initdata = {
 	.gpu = {
 		.rt_temp_address      = 0x80,
 		.rt_fan_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -659,6 +746,12 @@ static struct msi_ec_conf CONF7 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0xc9, // needs testing
@@ -671,6 +764,7 @@ static struct msi_ec_conf CONF7 __initdata = {
 	.gpu = {
 		.rt_temp_address      = MSI_EC_ADDR_UNKNOWN,
 		.rt_fan_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -736,6 +830,12 @@ static struct msi_ec_conf CONF8 __initdata = {
 			MSI_EC_MODE_NULL
 		},
 	},
+	.fan_curve = {
+		.cpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.cpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.gpu_temp_address  = MSI_EC_ADDR_UNKNOWN,
+		.gpu_speed_address = MSI_EC_ADDR_UNKNOWN,
+	},
 	.cpu = {
 		.rt_temp_address       = 0x68,
 		.rt_fan_speed_address  = 0x71,
@@ -748,6 +848,7 @@ static struct msi_ec_conf CONF8 __initdata = {
 	.gpu = {
 		.rt_temp_address      = MSI_EC_ADDR_UNKNOWN,
 		.rt_fan_speed_address = MSI_EC_ADDR_UNKNOWN,
+		.bs_fan_speed_address = MSI_EC_ADDR_UNSUPP,
 	},
 	.leds = {
 		.micmute_led_address = MSI_EC_ADDR_UNSUPP,
@@ -777,6 +878,34 @@ static struct msi_ec_conf *CONFIGURATIONS[] __initdata = {
 	NULL
 };
 
+// Models known by their board name, the firmware scan is the fallback
+#define MSI_EC_DMI_BOARD(_board, _conf) {					\
+	.ident = _board,							\
+	.matches = {								\
+		DMI_MATCH(DMI_BOARD_VENDOR, "Micro-Star International Co., Ltd."), \
+		DMI_MATCH(DMI_BOARD_NAME, _board),				\
+	},									\
+	.driver_data = &_conf,							\
+}
+
+static const struct dmi_system_id msi_ec_dmi_table[] __initconst = {
+	MSI_EC_DMI_BOARD("MS-14C1", CONF0),
+	MSI_EC_DMI_BOARD("MS-17F2", CONF1),
+	MSI_EC_DMI_BOARD("MS-1552", CONF2),
+	MSI_EC_DMI_BOARD("MS-1592", CONF3),
+	MSI_EC_DMI_BOARD("MS-16V4", CONF4),
+	MSI_EC_DMI_BOARD("MS-158L", CONF5),
+	MSI_EC_DMI_BOARD("MS-1542", CONF6),
+	MSI_EC_DMI_BOARD("MS-17FK", CONF7),
+	MSI_EC_DMI_BOARD("MS-14F1", CONF8),
+	{ }
+};
+
+static bool fw_check;
+module_param(fw_check, bool, 0444);
+MODULE_PARM_DESC(fw_check,
+		 "Confirm models matched by DMI against their supported firmware versions");
+
 static struct msi_ec_conf conf; // current configuration
 
 struct attribute_support {
@@ -786,8 +915,6 @@ struct attribute_support {
 
 #define streq(x, y) (strcmp(x, y) == 0 || strcmp(x, y "\n") == 0)
 
-#define set_bit(v, b)   (v |= (1 << b))
-#define unset_bit(v, b) (v &= ~(1 << b))
 #define check_bit(v, b) ((bool)((v >> b) & 1))
 
 // compares two strings, trimming newline at the end the second
@@ -819,74 +946,314 @@ static int ec_read_seq(u8 addr, u8 *buf, u8 len)
 	return 0;
 }
 
-static int ec_set_by_mask(u8 addr, u8 mask)
+// ============================================================ //
+// Time-in-state accounting
+// ============================================================ //
+
+#define MSI_EC_RESIDENCY_STATES  6 // modes[] entries plus "unknown"
+#define MSI_EC_RESIDENCY_UNKNOWN (MSI_EC_RESIDENCY_STATES - 1)
+
+struct msi_ec_residency {
+	int state; // -1 until the first observation
+	ktime_t entered;
+	u64 time_ns[MSI_EC_RESIDENCY_STATES];
+	u64 entries[MSI_EC_RESIDENCY_STATES];
+	u64 transitions;
+};
+
+static DEFINE_SPINLOCK(residency_lock);
+static struct msi_ec_residency shift_mode_residency = { .state = -1 };
+static struct msi_ec_residency fan_mode_residency = { .state = -1 };
+static struct msi_ec_residency cooler_boost_residency = { .state = -1 };
+
+static int residency_mode_state(const struct msi_ec_mode *modes, u8 value)
 {
-	int result;
-	u8 stored;
+	for (int i = 0; modes[i].name; i++) {
+		// NULL entries have NULL name
 
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		return result;
+		if (modes[i].value == value)
+			return i;
+	}
+
+	return MSI_EC_RESIDENCY_UNKNOWN;
+}
 
-	stored |= mask;
+static void msi_battery_changed(void);
 
-	return ec_write(addr, stored);
+// last charge_control value seen, guarded by ec_lock
+static int charge_control_seen = -1;
+
+// must be called with residency_lock held
+static void residency_enter(struct msi_ec_residency *residency, int state,
+			    ktime_t now)
+{
+	if (residency->state == state)
+		return;
+
+	if (residency->state >= 0) {
+		residency->time_ns[residency->state] +=
+			ktime_to_ns(ktime_sub(now, residency->entered));
+		residency->transitions++;
+	}
+
+	residency->state = state;
+	residency->entered = now;
+	residency->entries[state]++;
 }
 
-static int ec_unset_by_mask(u8 addr, u8 mask)
+// called for every value read from or written to the EC, with ec_lock held
+static void msi_ec_observe(u8 addr, u8 value)
+{
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	spin_lock_irqsave(&residency_lock, flags);
+
+	if (addr == conf.shift_mode.address)
+		residency_enter(&shift_mode_residency,
+				residency_mode_state(conf.shift_mode.modes, value),
+				now);
+
+	if (addr == conf.fan_mode.address)
+		residency_enter(&fan_mode_residency,
+				residency_mode_state(conf.fan_mode.modes, value),
+				now);
+
+	if (addr == conf.cooler_boost.address)
+		residency_enter(&cooler_boost_residency,
+				check_bit(value, conf.cooler_boost.bit),
+				now);
+
+	spin_unlock_irqrestore(&residency_lock, flags);
+
+	if (addr == conf.charge_control.address) {
+		if (charge_control_seen >= 0 && charge_control_seen != value)
+			msi_battery_changed();
+		charge_control_seen = value;
+	}
+}
+
+// ============================================================ //
+// EC register cache
+// ============================================================ //
+
+// Off by default: the firmware toggles several registers on its own and
+// nothing tells the driver when, so cached values could be stale
+static unsigned int cache_ttl_ms;
+module_param(cache_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(cache_ttl_ms,
+		 "Lifetime of cached EC register values in ms (0 disables caching of registers without their own lifetime)");
+
+static unsigned int write_retries;
+module_param(write_retries, uint, 0644);
+MODULE_PARM_DESC(write_retries,
+		 "Rewrites of a control register that reads back another value (0 disables write verification)");
+
+#define EC_CACHE_TTL_DEFAULT 0        // follow cache_ttl_ms
+#define EC_CACHE_TTL_FOREVER UINT_MAX // write-owned, only this driver changes it
+
+struct ec_cache_entry {
+	unsigned long expires; // jiffies
+	unsigned int ttl_ms;   // per register override of cache_ttl_ms
+	bool verify;           // control register, read back after writes
+	u32 writes;            // successful writes by this driver
+	bool valid;
+	u8 value;
+};
+
+// serializes EC accesses of this driver and guards the register cache
+static DEFINE_MUTEX(ec_lock);
+static struct ec_cache_entry ec_cache[256];
+
+static void __init ec_cache_init(void)
+{
+	const int controls[] = {
+		conf.charge_control.address,
+		conf.cooler_boost.address,
+		conf.shift_mode.address,
+		conf.super_battery.address,
+		conf.fan_mode.address,
+	};
+
+	for (int i = 0; i < ARRAY_SIZE(controls); i++) {
+		if (controls[i] != MSI_EC_ADDR_UNSUPP)
+			ec_cache[controls[i]].verify = true;
+	}
+
+	// only changed by this driver, reads never reach the EC
+	if (conf.charge_control.address != MSI_EC_ADDR_UNSUPP)
+		ec_cache[conf.charge_control.address].ttl_ms = EC_CACHE_TTL_FOREVER;
+}
+
+// must be called with ec_lock held
+static void __ec_cache_store(u8 addr, u8 value)
+{
+	struct ec_cache_entry *entry = &ec_cache[addr];
+	unsigned int ttl_ms = entry->ttl_ms ?: cache_ttl_ms;
+
+	msi_ec_observe(addr, value);
+
+	entry->value = value;
+	entry->valid = true;
+	if (ttl_ms != EC_CACHE_TTL_FOREVER)
+		entry->expires = jiffies + msecs_to_jiffies(ttl_ms);
+}
+
+// must be called with ec_lock held
+static int __ec_read_fresh(u8 addr, u8 *out)
 {
 	int result;
-	u8 stored;
 
-	result = ec_read(addr, &stored);
+	result = ec_read(addr, out);
 	if (result < 0)
 		return result;
 
-	stored &= ~mask;
+	__ec_cache_store(addr, *out);
+	return 0;
+}
+
+// must be called with ec_lock held
+static int __ec_read_cached(u8 addr, u8 *out)
+{
+	struct ec_cache_entry *entry = &ec_cache[addr];
+	unsigned int ttl_ms = entry->ttl_ms ?: READ_ONCE(cache_ttl_ms);
+
+	if (ttl_ms && entry->valid &&
+	    (ttl_ms == EC_CACHE_TTL_FOREVER ||
+	     time_before(jiffies, entry->expires))) {
+		*out = entry->value;
+		return 0;
+	}
 
-	return ec_write(addr, stored);
+	return __ec_read_fresh(addr, out);
 }
 
-static int ec_check_by_mask(u8 addr, u8 mask, bool *output)
+// must be called with ec_lock held, mask holds the bits the caller means
+// to change: the firmware may flip the others, so only these are verified
+static int __ec_write_bits(u8 addr, u8 value, u8 mask)
 {
+	unsigned int retries = READ_ONCE(write_retries);
+	unsigned int attempt = 0;
 	int result;
 	u8 stored;
 
-	result = ec_read(addr, &stored);
-	if (result < 0)
-		return result;
+	for (;;) {
+		result = ec_write(addr, value);
+		if (result < 0)
+			goto err;
 
-	*output = ((stored & mask) == mask);
+		if (!retries || !ec_cache[addr].verify)
+			break;
+
+		// some firmwares silently drop writes under load
+		result = ec_read(addr, &stored);
+		if (result < 0)
+			goto err;
+
+		if (((stored ^ value) & mask) == 0) {
+			value = stored;
+			break;
+		}
+
+		if (attempt++ == retries) {
+			pr_warn_ratelimited("write of 0x%02x to 0x%02x did not stick (0x%02x)\n",
+					    value, addr, stored);
+			result = -EIO;
+			goto err;
+		}
+
+		usleep_range(1000 << min(attempt, 4U), 2000 << min(attempt, 4U));
+	}
 
+	ec_cache[addr].writes++;
+	__ec_cache_store(addr, value);
 	return 0;
+
+err:
+	ec_cache[addr].valid = false;
+	return result;
 }
 
-static int ec_set_bit(u8 addr, u8 bit)
+// must be called with ec_lock held
+static int __ec_write(u8 addr, u8 value)
+{
+	return __ec_write_bits(addr, value, 0xff);
+}
+
+static int ec_read_cached(u8 addr, u8 *out)
+{
+	int result;
+
+	mutex_lock(&ec_lock);
+	result = __ec_read_cached(addr, out);
+	mutex_unlock(&ec_lock);
+
+	return result;
+}
+
+static int ec_write_through(u8 addr, u8 value)
+{
+	int result;
+
+	mutex_lock(&ec_lock);
+	result = __ec_write(addr, value);
+	mutex_unlock(&ec_lock);
+
+	return result;
+}
+
+// read-modify-write, the read always bypasses the cache
+static int ec_update_bits(u8 addr, u8 mask, u8 bits)
 {
 	int result;
 	u8 stored;
 
-	result = ec_read(addr, &stored);
+	mutex_lock(&ec_lock);
+
+	result = __ec_read_fresh(addr, &stored);
 	if (result < 0)
-		return result;
+		goto out;
 
-	set_bit(stored, bit);
+	stored = (stored & ~mask) | (bits & mask);
+	result = __ec_write_bits(addr, stored, mask);
 
-	return ec_write(addr, stored);
+out:
+	mutex_unlock(&ec_lock);
+	return result;
 }
 
-static int ec_unset_bit(u8 addr, u8 bit)
+static int ec_set_by_mask(u8 addr, u8 mask)
+{
+	return ec_update_bits(addr, mask, mask);
+}
+
+static int ec_unset_by_mask(u8 addr, u8 mask)
+{
+	return ec_update_bits(addr, mask, 0);
+}
+
+static int ec_check_by_mask(u8 addr, u8 mask, bool *output)
 {
 	int result;
 	u8 stored;
 
-	result = ec_read(addr, &stored);
+	result = ec_read_cached(addr, &stored);
 	if (result < 0)
 		return result;
 
-	unset_bit(stored, bit);
+	*output = ((stored & mask) == mask);
+
+	return 0;
+}
+
+static int ec_set_bit(u8 addr, u8 bit)
+{
+	return ec_update_bits(addr, 1 << bit, 1 << bit);
+}
 
-	return ec_write(addr, stored);
+static int ec_unset_bit(u8 addr, u8 bit)
+{
+	return ec_update_bits(addr, 1 << bit, 0);
 }
 
 static int ec_check_bit(u8 addr, u8 bit, bool *output)
@@ -894,7 +1261,7 @@ static int ec_check_bit(u8 addr, u8 bit, bool *output)
 	int result;
 	u8 stored;
 
-	result = ec_read(addr, &stored);
+	result = ec_read_cached(addr, &stored);
 	if (result < 0)
 		return result;
 
@@ -927,7 +1294,7 @@ static ssize_t charge_control_threshold_show(u8 offset, struct device *device,
 	u8 rdata;
 	int result;
 
-	result = ec_read(conf.charge_control.address, &rdata);
+	result = ec_read_cached(conf.charge_control.address, &rdata);
 	if (result < 0)
 		return result;
 
@@ -950,7 +1317,7 @@ static ssize_t charge_control_threshold_store(u8 offset, struct device *dev,
 	    wdata > conf.charge_control.range_max)
 		return -EINVAL;
 
-	result = ec_write(conf.charge_control.address, wdata);
+	result = ec_write_through(conf.charge_control.address, wdata);
 	if (result < 0)
 		return result;
 
@@ -990,25 +1357,132 @@ static ssize_t charge_control_end_threshold_store(struct device *dev,
 					      dev, attr, buf, count);
 }
 
+// Both thresholds live in the same register, so the end threshold is
+// always the start threshold plus (offset_start - offset_end)
+static ssize_t charge_control_thresholds_show(struct device *device,
+					      struct device_attribute *attr,
+					      char *buf)
+{
+	u8 rdata;
+	int result;
+
+	result = ec_read_cached(conf.charge_control.address, &rdata);
+	if (result < 0)
+		return result;
+
+	return sysfs_emit(buf, "%i %i\n",
+			  rdata - conf.charge_control.offset_start,
+			  rdata - conf.charge_control.offset_end);
+}
+
+// "<start> <end>", committed with a single EC write
+static ssize_t charge_control_thresholds_store(struct device *dev,
+					       struct device_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned int start, end;
+	int wdata;
+	int result;
+
+	if (sscanf(buf, "%u %u", &start, &end) != 2)
+		return -EINVAL;
+
+	if (start > 100 || end > 100)
+		return -EINVAL;
+
+	wdata = start + conf.charge_control.offset_start;
+	if (wdata != end + conf.charge_control.offset_end)
+		return -EINVAL;
+
+	if (wdata < conf.charge_control.range_min ||
+	    wdata > conf.charge_control.range_max)
+		return -EINVAL;
+
+	result = ec_write_through(conf.charge_control.address, wdata);
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
 static DEVICE_ATTR_RW(charge_control_start_threshold);
 static DEVICE_ATTR_RW(charge_control_end_threshold);
+static DEVICE_ATTR_RW(charge_control_thresholds);
 
 static struct attribute *msi_battery_attrs[] = {
 	&dev_attr_charge_control_start_threshold.attr,
 	&dev_attr_charge_control_end_threshold.attr,
+	&dev_attr_charge_control_thresholds.attr,
 	NULL
 };
 
 ATTRIBUTE_GROUPS(msi_battery);
 
-static int msi_battery_add(struct power_supply *battery)
+// hooked batteries, notified when charge_control changes
+struct msi_battery {
+	struct list_head list;
+	struct power_supply *psy;
+};
+
+static LIST_HEAD(msi_batteries);
+static DEFINE_MUTEX(msi_batteries_lock);
+
+static void msi_battery_changed_fn(struct work_struct *work)
+{
+	struct msi_battery *battery;
+
+	mutex_lock(&msi_batteries_lock);
+	list_for_each_entry(battery, &msi_batteries, list)
+		power_supply_changed(battery->psy);
+	mutex_unlock(&msi_batteries_lock);
+}
+
+static DECLARE_WORK(msi_battery_changed_work, msi_battery_changed_fn);
+
+// called by the observer with ec_lock held
+static void msi_battery_changed(void)
+{
+	schedule_work(&msi_battery_changed_work);
+}
+
+static int msi_battery_add(struct power_supply *psy)
 {
-	return device_add_groups(&battery->dev, msi_battery_groups);
+	struct msi_battery *battery;
+	int result;
+
+	battery = kzalloc(sizeof(*battery), GFP_KERNEL);
+	if (!battery)
+		return -ENOMEM;
+
+	result = device_add_groups(&psy->dev, msi_battery_groups);
+	if (result < 0) {
+		kfree(battery);
+		return result;
+	}
+
+	battery->psy = psy;
+
+	mutex_lock(&msi_batteries_lock);
+	list_add_tail(&battery->list, &msi_batteries);
+	mutex_unlock(&msi_batteries_lock);
+
+	return 0;
 }
 
-static int msi_battery_remove(struct power_supply *battery)
+static int msi_battery_remove(struct power_supply *psy)
 {
-	device_remove_groups(&battery->dev, msi_battery_groups);
+	struct msi_battery *battery, *tmp;
+
+	mutex_lock(&msi_batteries_lock);
+	list_for_each_entry_safe(battery, tmp, &msi_batteries, list) {
+		if (battery->psy == psy) {
+			list_del(&battery->list);
+			kfree(battery);
+		}
+	}
+	mutex_unlock(&msi_batteries_lock);
+
+	device_remove_groups(&psy->dev, msi_battery_groups);
 	return 0;
 }
 
@@ -1167,7 +1641,7 @@ static ssize_t battery_mode_show(struct device *device,
 	u8 rdata;
 	int result;
 
-	result = ec_read(conf.charge_control.address, &rdata);
+	result = ec_read_cached(conf.charge_control.address, &rdata);
 	if (result < 0)
 		return result;
 
@@ -1189,16 +1663,16 @@ static ssize_t battery_mode_store(struct device *dev,
 	int result = -EINVAL;
 
 	if (streq(buf, "max"))
-		result = ec_write(conf.charge_control.address,
-				  conf.charge_control.range_max);
+		result = ec_write_through(conf.charge_control.address,
+					  conf.charge_control.range_max);
 
 	else if (streq(buf, "medium")) // up to 80%
-		result = ec_write(conf.charge_control.address,
-				  conf.charge_control.offset_end + 80);
+		result = ec_write_through(conf.charge_control.address,
+					  conf.charge_control.offset_end + 80);
 
 	else if (streq(buf, "min")) // up to 60%
-		result = ec_write(conf.charge_control.address,
-				  conf.charge_control.offset_end + 60);
+		result = ec_write_through(conf.charge_control.address,
+					  conf.charge_control.offset_end + 60);
 
 	if (result < 0)
 		return result;
@@ -1206,6 +1680,107 @@ static ssize_t battery_mode_store(struct device *dev,
 	return count;
 }
 
+// Timed boosts ("on 120s", "on 2m") are reverted by the timer, which
+// defers the EC write to a work item
+#define MSI_EC_COOLER_BOOST_MAX_S (24 * 60 * 60)
+
+static struct hrtimer cooler_boost_timer;
+static DEFINE_MUTEX(cooler_boost_lock); // guards cooler_boost_timed
+static bool cooler_boost_timed;
+
+static void cooler_boost_revert_fn(struct work_struct *work)
+{
+	int result;
+
+	mutex_lock(&cooler_boost_lock);
+
+	// re-armed or made permanent after the timer has fired
+	if (!cooler_boost_timed || hrtimer_active(&cooler_boost_timer))
+		goto out;
+
+	cooler_boost_timed = false;
+	result = ec_unset_bit(conf.cooler_boost.address, conf.cooler_boost.bit);
+	if (result < 0)
+		pr_warn("failed to turn cooler boost off (%d)\n", result);
+
+out:
+	mutex_unlock(&cooler_boost_lock);
+}
+
+static DECLARE_WORK(cooler_boost_revert_work, cooler_boost_revert_fn);
+
+static enum hrtimer_restart cooler_boost_timer_fn(struct hrtimer *timer)
+{
+	schedule_work(&cooler_boost_revert_work);
+	return HRTIMER_NORESTART;
+}
+
+// parses "<n>s" or "<n>m" into seconds
+static int cooler_boost_parse_duration(const char *buf, unsigned int *seconds)
+{
+	char copy[16];
+	char *number;
+	unsigned int multiplier;
+	size_t length;
+	int result;
+
+	if (strscpy(copy, buf, sizeof(copy)) < 0)
+		return -EINVAL;
+
+	number = strim(copy);
+	length = strlen(number);
+	if (length < 2)
+		return -EINVAL;
+
+	switch (number[length - 1]) {
+	case 's':
+		multiplier = 1;
+		break;
+	case 'm':
+		multiplier = 60;
+		break;
+	default:
+		return -EINVAL;
+	}
+	number[length - 1] = '\0';
+
+	result = kstrtouint(number, 10, seconds);
+	if (result < 0)
+		return result;
+
+	if (*seconds == 0 || *seconds > MSI_EC_COOLER_BOOST_MAX_S / multiplier)
+		return -EINVAL;
+
+	*seconds *= multiplier;
+	return 0;
+}
+
+// must be called with cooler_boost_lock held
+static int cooler_boost_on_for(unsigned int seconds)
+{
+	int result;
+	bool enabled;
+
+	// extending a running boost only re-arms the timer
+	result = ec_check_bit(conf.cooler_boost.address, conf.cooler_boost.bit,
+			      &enabled);
+	if (result < 0)
+		return result;
+
+	if (!enabled) {
+		result = ec_set_bit(conf.cooler_boost.address,
+				    conf.cooler_boost.bit);
+		if (result < 0)
+			return result;
+	}
+
+	cooler_boost_timed = true;
+	hrtimer_start(&cooler_boost_timer, ktime_set(seconds, 0),
+		      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
 static ssize_t cooler_boost_show(struct device *device,
 				 struct device_attribute *attr, char *buf)
 {
@@ -1226,21 +1801,73 @@ static ssize_t cooler_boost_store(struct device *dev,
 				  const char *buf, size_t count)
 {
 	int result = -EINVAL;
+	unsigned int seconds;
 
-	if (streq(buf, "on"))
+	mutex_lock(&cooler_boost_lock);
+
+	if (streq(buf, "on")) {
+		hrtimer_cancel(&cooler_boost_timer);
+		cooler_boost_timed = false;
 		result = ec_set_bit(conf.cooler_boost.address,
 				    conf.cooler_boost.bit);
 
-	else if (streq(buf, "off"))
+	} else if (streq(buf, "off")) {
+		hrtimer_cancel(&cooler_boost_timer);
+		cooler_boost_timed = false;
 		result = ec_unset_bit(conf.cooler_boost.address,
 				      conf.cooler_boost.bit);
 
+	} else if (strncmp(buf, "on ", 3) == 0) {
+		result = cooler_boost_parse_duration(buf + 3, &seconds);
+		if (result == 0)
+			result = cooler_boost_on_for(seconds);
+	}
+
+	mutex_unlock(&cooler_boost_lock);
+
 	if (result < 0)
 		return result;
 
 	return count;
 }
 
+// seconds until a timed boost is reverted, 0 if none is running
+static ssize_t cooler_boost_remaining_show(struct device *device,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	s64 remaining_ms = 0;
+
+	if (READ_ONCE(cooler_boost_timed) && hrtimer_active(&cooler_boost_timer))
+		remaining_ms = ktime_to_ms(hrtimer_get_remaining(&cooler_boost_timer));
+
+	return sysfs_emit(buf, "%llu\n",
+			  DIV_ROUND_UP_ULL(max(remaining_ms, 0LL), 1000));
+}
+
+static void __init cooler_boost_timer_init(void)
+{
+	hrtimer_init(&cooler_boost_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	cooler_boost_timer.function = cooler_boost_timer_fn;
+}
+
+// a pending timed boost is reverted right away
+static void cooler_boost_timer_stop(void)
+{
+	bool pending;
+
+	hrtimer_cancel(&cooler_boost_timer);
+	cancel_work_sync(&cooler_boost_revert_work);
+
+	mutex_lock(&cooler_boost_lock);
+	pending = cooler_boost_timed;
+	cooler_boost_timed = false;
+	mutex_unlock(&cooler_boost_lock);
+
+	if (pending)
+		ec_unset_bit(conf.cooler_boost.address, conf.cooler_boost.bit);
+}
+
 static ssize_t available_shift_modes_show(struct device *device,
 				          struct device_attribute *attr,
 				          char *buf)
@@ -1267,7 +1894,7 @@ static ssize_t shift_mode_show(struct device *device,
 	u8 rdata;
 	int result;
 
-	result = ec_read(conf.shift_mode.address, &rdata);
+	result = ec_read_cached(conf.shift_mode.address, &rdata);
 	if (result < 0)
 		return result;
 
@@ -1295,8 +1922,8 @@ static ssize_t shift_mode_store(struct device *dev,
 		// NULL entries have NULL name
 
 		if (strcmp_trim_newline2(conf.shift_mode.modes[i].name, buf) == 0) {
-			result = ec_write(conf.shift_mode.address,
-					  conf.shift_mode.modes[i].value);
+			result = ec_write_through(conf.shift_mode.address,
+						  conf.shift_mode.modes[i].value);
 			if (result < 0)
 				return result;
 
@@ -1369,7 +1996,7 @@ static ssize_t fan_mode_show(struct device *device,
 	u8 rdata;
 	int result;
 
-	result = ec_read(conf.fan_mode.address, &rdata);
+	result = ec_read_cached(conf.fan_mode.address, &rdata);
 	if (result < 0)
 		return result;
 
@@ -1393,8 +2020,8 @@ static ssize_t fan_mode_store(struct device *dev, struct device_attribute *attr,
 		// NULL entries have NULL name
 
 		if (strcmp_trim_newline2(conf.fan_mode.modes[i].name, buf) == 0) {
-			result = ec_write(conf.fan_mode.address,
-					  conf.fan_mode.modes[i].value);
+			result = ec_write_through(conf.fan_mode.address,
+						  conf.fan_mode.modes[i].value);
 			if (result < 0)
 				return result;
 
@@ -1450,6 +2077,7 @@ static DEVICE_ATTR_RW(fn_key);
 static DEVICE_ATTR_RW(win_key);
 static DEVICE_ATTR_RW(battery_mode);
 static DEVICE_ATTR_RW(cooler_boost);
+static DEVICE_ATTR_RO(cooler_boost_remaining);
 static DEVICE_ATTR_RO(available_shift_modes);
 static DEVICE_ATTR_RW(shift_mode);
 static DEVICE_ATTR_RW(super_battery);
@@ -1476,25 +2104,141 @@ static ssize_t cpu_realtime_temperature_show(struct device *device,
 	return sysfs_emit(buf, "%i\n", rdata);
 }
 
-static ssize_t cpu_realtime_fan_speed_show(struct device *device,
-					   struct device_attribute *attr,
-					   char *buf)
+// Raw realtime fan speeds are scaled by a range that starts from
+// cpu_fan_range or the configuration and is widened by the values
+// observed since boot. It never shrinks: a fan that has only been seen
+// idle must not read as running at full speed.
+static int cpu_fan_range[2];
+static int cpu_fan_range_count;
+module_param_array(cpu_fan_range, int, &cpu_fan_range_count, 0444);
+MODULE_PARM_DESC(cpu_fan_range,
+		 "Initial raw realtime fan speed range as min,max (see cpu/realtime_fan_speed_range)");
+
+// a value must be read this many times in a row before it widens the
+// learned range, so a single bad read cannot stretch it for good
+#define CPU_FAN_RANGE_CONFIRM 3
+
+// lo, hi, candidate and its count, one byte each from the low one; lo > hi
+// while there is neither a seed nor an observed value. Lockless,
+// conversions can happen in any context.
+static atomic_t cpu_fan_range_learned;
+
+#define CPU_FAN_RANGE(_lo, _hi, _candidate, _count) \
+	((_lo) | (_hi) << 8 | (_candidate) << 16 | (_count) << 24)
+
+static void cpu_fan_range_get(u8 *lo, u8 *hi)
 {
-	u8 rdata;
+	int range = atomic_read(&cpu_fan_range_learned);
+
+	*lo = range & 0xff;
+	*hi = (range >> 8) & 0xff;
+}
+
+static void cpu_fan_range_observe(u8 raw)
+{
+	int range = atomic_read(&cpu_fan_range_learned);
+	int next;
+	u8 lo, hi, candidate, count;
+
+	do {
+		lo = range & 0xff;
+		hi = (range >> 8) & 0xff;
+		candidate = (range >> 16) & 0xff;
+		count = (range >> 24) & 0xff;
+
+		if (lo <= hi && raw >= lo && raw <= hi) {
+			if (!count)
+				return;
+			count = 0;
+		} else if (count && candidate == raw) {
+			count++;
+		} else {
+			candidate = raw;
+			count = 1;
+		}
+
+		if (count == CPU_FAN_RANGE_CONFIRM) {
+			lo = min(lo, raw);
+			hi = max(hi, raw);
+			count = 0;
+		}
+
+		next = CPU_FAN_RANGE(lo, hi, candidate, count);
+	} while (!atomic_try_cmpxchg(&cpu_fan_range_learned, &range, next));
+}
+
+// cpu_fan_range takes precedence, so it can also narrow a configuration
+// range that is too wide
+static void __init cpu_fan_range_init(void)
+{
+	int lo = 0xff, hi = 0; // nothing to seed from
+
+	if (cpu_fan_range_count == 2 &&
+	    cpu_fan_range[0] >= 0 && cpu_fan_range[0] < cpu_fan_range[1] &&
+	    cpu_fan_range[1] <= 0xff) {
+		lo = cpu_fan_range[0];
+		hi = cpu_fan_range[1];
+	} else {
+		if (cpu_fan_range_count)
+			pr_warn("ignoring invalid cpu_fan_range\n");
+
+		if (conf.cpu.rt_fan_speed_base_min >= 0 &&
+		    conf.cpu.rt_fan_speed_base_min < conf.cpu.rt_fan_speed_base_max &&
+		    conf.cpu.rt_fan_speed_base_max <= 0xff) {
+			lo = conf.cpu.rt_fan_speed_base_min;
+			hi = conf.cpu.rt_fan_speed_base_max;
+		}
+	}
+
+	atomic_set(&cpu_fan_range_learned, CPU_FAN_RANGE(lo, hi, 0, 0));
+}
+
+// converts a raw realtime fan speed value into percents, learning the
+// range first
+static int cpu_fan_speed_percent(u8 raw, u8 *percent)
+{
+	u8 lo, hi;
+
+	cpu_fan_range_observe(raw);
+	cpu_fan_range_get(&lo, &hi);
+
+	if (lo >= hi) {
+		*percent = 0;
+		return 0;
+	}
+
+	*percent = 100 * (clamp(raw, lo, hi) - lo) / (hi - lo);
+	return 0;
+}
+
+static ssize_t cpu_realtime_fan_speed_show(struct device *device,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	u8 rdata, percent;
 	int result;
 
 	result = ec_read(conf.cpu.rt_fan_speed_address, &rdata);
 	if (result < 0)
 		return result;
 
-	if ((rdata < conf.cpu.rt_fan_speed_base_min ||
-	    rdata > conf.cpu.rt_fan_speed_base_max))
-		return -EINVAL;
+	result = cpu_fan_speed_percent(rdata, &percent);
+	if (result < 0)
+		return result;
 
-	return sysfs_emit(buf, "%i\n",
-		          100 * (rdata - conf.cpu.rt_fan_speed_base_min) /
-				  (conf.cpu.rt_fan_speed_base_max -
-				   conf.cpu.rt_fan_speed_base_min));
+	return sysfs_emit(buf, "%i\n", percent);
+}
+
+static ssize_t cpu_realtime_fan_speed_range_show(struct device *device,
+						 struct device_attribute *attr,
+						 char *buf)
+{
+	u8 lo, hi;
+
+	cpu_fan_range_get(&lo, &hi);
+
+	// in the format of cpu_fan_range
+	return sysfs_emit(buf, "%u,%u\n", lo, hi);
 }
 
 static ssize_t cpu_basic_fan_speed_show(struct device *device,
@@ -1504,7 +2248,7 @@ static ssize_t cpu_basic_fan_speed_show(struct device *device,
 	u8 rdata;
 	int result;
 
-	result = ec_read(conf.cpu.bs_fan_speed_address, &rdata);
+	result = ec_read_cached(conf.cpu.bs_fan_speed_address, &rdata);
 	if (result < 0)
 		return result;
 
@@ -1532,11 +2276,11 @@ static ssize_t cpu_basic_fan_speed_store(struct device *dev,
 	if (wdata > 100)
 		return -EINVAL;
 
-	result = ec_write(conf.cpu.bs_fan_speed_address,
-			  (wdata * (conf.cpu.bs_fan_speed_base_max -
-				    conf.cpu.bs_fan_speed_base_min) +
-			   100 * conf.cpu.bs_fan_speed_base_min) /
-				  100);
+	result = ec_write_through(conf.cpu.bs_fan_speed_address,
+				  (wdata * (conf.cpu.bs_fan_speed_base_max -
+					    conf.cpu.bs_fan_speed_base_min) +
+				   100 * conf.cpu.bs_fan_speed_base_min) /
+					  100);
 	if (result < 0)
 		return result;
 
@@ -1559,6 +2303,14 @@ static struct device_attribute dev_attr_cpu_realtime_fan_speed = {
 	.show = cpu_realtime_fan_speed_show,
 };
 
+static struct device_attribute dev_attr_cpu_realtime_fan_speed_range = {
+	.attr = {
+		.name = "realtime_fan_speed_range",
+		.mode = 0444,
+	},
+	.show = cpu_realtime_fan_speed_range_show,
+};
+
 static struct device_attribute dev_attr_cpu_basic_fan_speed = {
 	.attr = {
 		.name = "basic_fan_speed",
@@ -1571,6 +2323,7 @@ static struct device_attribute dev_attr_cpu_basic_fan_speed = {
 static struct attribute *msi_cpu_attrs[] = {
 	&dev_attr_cpu_realtime_temperature.attr,
 	&dev_attr_cpu_realtime_fan_speed.attr,
+	&dev_attr_cpu_realtime_fan_speed_range.attr,
 	&dev_attr_cpu_basic_fan_speed.attr,
 	NULL
 };
@@ -1639,232 +2392,4074 @@ static const struct attribute_group msi_gpu_group = {
 	.attrs = msi_gpu_attrs,
 };
 
-static struct attribute_group msi_root_group;
+// ============================================================ //
+// EC fields
+// ============================================================ //
 
-static const struct attribute_group *msi_platform_groups[] = {
-	&msi_root_group,
-	&msi_cpu_group,
-	&msi_gpu_group,
-	NULL
+enum msi_ec_field_kind {
+	MSI_EC_FIELD_KIND_BIT,          // 1 when the mask bit is set
+	MSI_EC_FIELD_KIND_BIT_INVERTED, // 1 when the mask bit is clear
+	MSI_EC_FIELD_KIND_MASK,         // 1 when all mask bits are set
+	MSI_EC_FIELD_KIND_MODE,         // raw value out of the modes
+	MSI_EC_FIELD_KIND_RAW,
+	MSI_EC_FIELD_KIND_CHARGE,       // charge_control, percent
+	MSI_EC_FIELD_KIND_RT_FAN,       // realtime fan speed, percent
+	MSI_EC_FIELD_KIND_BS_FAN,       // basic fan speed, percent
+	MSI_EC_FIELD_KIND_KBD_BL,       // backlight level
 };
 
-static int msi_platform_probe(struct platform_device *pdev)
-{
-	// ALL root attributes and their support flags
-	struct attribute_support msi_root_attrs_support[] = {
-		{
-			&dev_attr_webcam.attr,
-			conf.webcam.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_webcam_block.attr,
-			conf.webcam.block_address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_fn_key.attr,
-			conf.fn_win_swap.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_win_key.attr,
-			conf.fn_win_swap.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_battery_mode.attr,
-			conf.charge_control.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_cooler_boost.attr,
-			conf.cooler_boost.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_available_shift_modes.attr,
-			conf.shift_mode.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_shift_mode.attr,
-			conf.shift_mode.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_super_battery.attr,
-			conf.super_battery.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_available_fan_modes.attr,
-			conf.fan_mode.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_fan_mode.attr,
-			conf.fan_mode.address != MSI_EC_ADDR_UNSUPP,
-		},
-		{
-			&dev_attr_fw_version.attr,
-			true,
-		},
-		{
-			&dev_attr_fw_release_date.attr,
-			true,
-		},
-	};
-
-	const int attributes_count =
-		sizeof(msi_root_attrs_support) / sizeof(msi_root_attrs_support[0]);
+struct msi_ec_field {
+	const char *name;
+	int address; // MSI_EC_ADDR_UNSUPP when not supported
+	u8 mask;
+	enum msi_ec_field_kind kind;
+	const struct msi_ec_mode *modes;
+};
 
-	// supported root attributes
-	struct attribute **msi_root_attrs =
-		kcalloc(attributes_count, sizeof(struct attribute *), GFP_KERNEL);
-	if (!msi_root_attrs)
-		return -ENOMEM;
+// indexed by enum msi_ec_field_id, filled from the current configuration
+static struct msi_ec_field msi_ec_fields[MSI_EC_FIELD_COUNT];
 
-	// copy supported attributes only
-	for (int i = 0, j = 0; i < attributes_count; i++) {
-		if (msi_root_attrs_support[i].supported)
-			msi_root_attrs[j++] = msi_root_attrs_support[i].attribute;
+#define MSI_EC_FIELD(_id, _name, _address, _mask, _kind)		\
+	msi_ec_fields[_id] = (struct msi_ec_field) {			\
+		.name = _name,						\
+		.address = _address,					\
+		.mask = _mask,						\
+		.kind = MSI_EC_FIELD_KIND_##_kind,			\
 	}
 
-	// save attributes in the group
-	msi_root_group.attrs = msi_root_attrs;
-
-	return sysfs_create_groups(&pdev->dev.kobj, msi_platform_groups);
+static void __init msi_ec_fields_init(void)
+{
+	MSI_EC_FIELD(MSI_EC_FIELD_WEBCAM, "webcam",
+		     conf.webcam.address, 1 << conf.webcam.bit, BIT);
+	MSI_EC_FIELD(MSI_EC_FIELD_WEBCAM_BLOCK, "webcam_block",
+		     conf.webcam.block_address, 1 << conf.webcam.bit, BIT_INVERTED);
+	MSI_EC_FIELD(MSI_EC_FIELD_FN_WIN_SWAP, "fn_key",
+		     conf.fn_win_swap.address, 1 << conf.fn_win_swap.bit, BIT);
+	MSI_EC_FIELD(MSI_EC_FIELD_COOLER_BOOST, "cooler_boost",
+		     conf.cooler_boost.address, 1 << conf.cooler_boost.bit, BIT);
+	MSI_EC_FIELD(MSI_EC_FIELD_SHIFT_MODE, "shift_mode",
+		     conf.shift_mode.address, 0xff, MODE);
+	MSI_EC_FIELD(MSI_EC_FIELD_SUPER_BATTERY, "super_battery",
+		     conf.super_battery.address, conf.super_battery.mask, MASK);
+	MSI_EC_FIELD(MSI_EC_FIELD_FAN_MODE, "fan_mode",
+		     conf.fan_mode.address, 0xff, MODE);
+	MSI_EC_FIELD(MSI_EC_FIELD_CHARGE_END, "charge_control_end_threshold",
+		     conf.charge_control.address, 0xff, CHARGE);
+	MSI_EC_FIELD(MSI_EC_FIELD_CPU_TEMP, "cpu/realtime_temperature",
+		     conf.cpu.rt_temp_address, 0xff, RAW);
+	MSI_EC_FIELD(MSI_EC_FIELD_CPU_FAN_SPEED, "cpu/realtime_fan_speed",
+		     conf.cpu.rt_fan_speed_address, 0xff, RT_FAN);
+	MSI_EC_FIELD(MSI_EC_FIELD_CPU_BASIC_FAN_SPEED, "cpu/basic_fan_speed",
+		     conf.cpu.bs_fan_speed_address, 0xff, BS_FAN);
+	MSI_EC_FIELD(MSI_EC_FIELD_GPU_TEMP, "gpu/realtime_temperature",
+		     conf.gpu.rt_temp_address, 0xff, RAW);
+	MSI_EC_FIELD(MSI_EC_FIELD_GPU_FAN_SPEED, "gpu/realtime_fan_speed",
+		     conf.gpu.rt_fan_speed_address, 0xff, RAW);
+	MSI_EC_FIELD(MSI_EC_FIELD_MICMUTE_LED, "micmute_led",
+		     conf.leds.micmute_led_address, 1 << conf.leds.bit, BIT);
+	MSI_EC_FIELD(MSI_EC_FIELD_MUTE_LED, "mute_led",
+		     conf.leds.mute_led_address, 1 << conf.leds.bit, BIT);
+	MSI_EC_FIELD(MSI_EC_FIELD_KBD_BACKLIGHT, "kbd_backlight",
+		     conf.kbd_bl.bl_state_address, MSI_EC_KBD_BL_STATE_MASK, KBD_BL);
+
+	msi_ec_fields[MSI_EC_FIELD_SHIFT_MODE].modes = conf.shift_mode.modes;
+	msi_ec_fields[MSI_EC_FIELD_FAN_MODE].modes = conf.fan_mode.modes;
 }
 
-static int msi_platform_remove(struct platform_device *pdev)
+static bool msi_ec_field_supported(const struct msi_ec_field *field)
 {
-	sysfs_remove_groups(&pdev->dev.kobj, msi_platform_groups);
-	kfree(msi_root_group.attrs);
-	return 0;
+	return field->address != MSI_EC_ADDR_UNSUPP;
 }
 
-static struct platform_device *msi_platform_device;
-
-static struct platform_driver msi_platform_driver = {
-	.driver = {
-		.name = MSI_EC_DRIVER_NAME,
-	},
-	.probe = msi_platform_probe,
-	.remove = msi_platform_remove,
-};
-
-// ============================================================ //
-// Sysfs leds subsystem
-// ============================================================ //
-
-static int micmute_led_sysfs_set(struct led_classdev *led_cdev,
-				 enum led_brightness brightness)
+static int msi_ec_field_decode(const struct msi_ec_field *field, u8 raw,
+			       u32 *value)
 {
+	u8 percent;
 	int result;
 
-	if (brightness) {
-		result = ec_set_bit(conf.leds.micmute_led_address, conf.leds.bit);
-	} else {
-		result = ec_unset_bit(conf.leds.micmute_led_address, conf.leds.bit);
+	switch (field->kind) {
+	case MSI_EC_FIELD_KIND_BIT:
+		*value = (raw & field->mask) != 0;
+		return 0;
+	case MSI_EC_FIELD_KIND_BIT_INVERTED:
+		*value = (raw & field->mask) == 0;
+		return 0;
+	case MSI_EC_FIELD_KIND_MASK:
+		*value = (raw & field->mask) == field->mask;
+		return 0;
+	case MSI_EC_FIELD_KIND_MODE:
+	case MSI_EC_FIELD_KIND_RAW:
+		*value = raw;
+		return 0;
+	case MSI_EC_FIELD_KIND_CHARGE:
+		*value = raw - conf.charge_control.offset_end;
+		return 0;
+	case MSI_EC_FIELD_KIND_RT_FAN:
+		result = cpu_fan_speed_percent(raw, &percent);
+		if (result < 0)
+			return result;
+		*value = percent;
+		return 0;
+	case MSI_EC_FIELD_KIND_BS_FAN:
+		if (raw < conf.cpu.bs_fan_speed_base_min ||
+		    raw > conf.cpu.bs_fan_speed_base_max)
+			return -EINVAL;
+		*value = 100 * (raw - conf.cpu.bs_fan_speed_base_min) /
+			 (conf.cpu.bs_fan_speed_base_max -
+			  conf.cpu.bs_fan_speed_base_min);
+		return 0;
+	case MSI_EC_FIELD_KIND_KBD_BL:
+		*value = raw & field->mask;
+		return 0;
 	}
 
-	if (result < 0)
-		return result;
-
-	return 0;
+	return -EINVAL;
 }
 
-static int mute_led_sysfs_set(struct led_classdev *led_cdev,
-			      enum led_brightness brightness)
+// true if the field shares its register with others, so it must be
+// written with read-modify-write
+static bool msi_ec_field_partial(const struct msi_ec_field *field)
 {
-	int result;
-
-	if (brightness) {
-		result = ec_set_bit(conf.leds.mute_led_address, conf.leds.bit);
-	} else {
-		result = ec_unset_bit(conf.leds.mute_led_address, conf.leds.bit);
-	}
-
-	if (result < 0)
-		return result;
-
-	return 0;
+	return field->kind == MSI_EC_FIELD_KIND_BIT ||
+	       field->kind == MSI_EC_FIELD_KIND_BIT_INVERTED ||
+	       field->kind == MSI_EC_FIELD_KIND_MASK;
 }
 
-static enum led_brightness kbd_bl_sysfs_get(struct led_classdev *led_cdev)
+// inverse of msi_ec_field_decode, stored is the current register value
+// and only matters for partial fields
+static int msi_ec_field_encode(const struct msi_ec_field *field, u32 value,
+			       u8 stored, u8 *raw)
 {
-	u8 rdata;
-	int result = ec_read(conf.kbd_bl.bl_state_address, &rdata);
-	if (result < 0)
+	switch (field->kind) {
+	case MSI_EC_FIELD_KIND_BIT:
+	case MSI_EC_FIELD_KIND_MASK:
+		if (value > 1)
+			return -EINVAL;
+		*raw = value ? stored | field->mask : stored & ~field->mask;
 		return 0;
-	return rdata & MSI_EC_KBD_BL_STATE_MASK;
+	case MSI_EC_FIELD_KIND_BIT_INVERTED:
+		if (value > 1)
+			return -EINVAL;
+		*raw = value ? stored & ~field->mask : stored | field->mask;
+		return 0;
+	case MSI_EC_FIELD_KIND_MODE:
+		for (int i = 0; field->modes && field->modes[i].name; i++) {
+			if (field->modes[i].value == value) {
+				*raw = value;
+				return 0;
+			}
+		}
+		return -EINVAL;
+	case MSI_EC_FIELD_KIND_CHARGE:
+		if (value > 100)
+			return -EINVAL;
+		value += conf.charge_control.offset_end;
+		if (value < conf.charge_control.range_min ||
+		    value > conf.charge_control.range_max)
+			return -EINVAL;
+		*raw = value;
+		return 0;
+	case MSI_EC_FIELD_KIND_BS_FAN:
+		if (value > 100)
+			return -EINVAL;
+		*raw = (value * (conf.cpu.bs_fan_speed_base_max -
+				 conf.cpu.bs_fan_speed_base_min) +
+			100 * conf.cpu.bs_fan_speed_base_min) / 100;
+		return 0;
+	case MSI_EC_FIELD_KIND_KBD_BL:
+		if (value > 3)
+			return -EINVAL;
+		*raw = conf.kbd_bl.state_base_value | value;
+		return 0;
+	case MSI_EC_FIELD_KIND_RAW:
+	case MSI_EC_FIELD_KIND_RT_FAN:
+		return -EACCES; // sensors
+	}
+
+	return -EINVAL;
 }
 
-static int kbd_bl_sysfs_set(struct led_classdev *led_cdev,
-			    enum led_brightness brightness)
+// lockless, for contexts that cannot sleep; never touches the EC
+static bool msi_ec_field_peek(const struct msi_ec_field *field, u32 *value)
 {
-	u8 wdata;
-	if (brightness < 0 || brightness > 3)
-		return -1;
-	wdata = conf.kbd_bl.state_base_value | brightness;
-	return ec_write(conf.kbd_bl.bl_state_address, wdata);
+	u8 raw;
+
+	if (!msi_ec_field_supported(field) ||
+	    !READ_ONCE(ec_cache[field->address].valid))
+		return false;
+
+	raw = READ_ONCE(ec_cache[field->address].value);
+
+	return msi_ec_field_decode(field, raw, value) == 0;
 }
 
-static struct led_classdev micmute_led_cdev = {
-	.name = "platform::micmute",
-	.max_brightness = 1,
-	.brightness_set_blocking = &micmute_led_sysfs_set,
-	.default_trigger = "audio-micmute",
-};
+// ============================================================ //
+// Sensor statistics
+// ============================================================ //
 
-static struct led_classdev mute_led_cdev = {
-	.name = "platform::mute",
-	.max_brightness = 1,
-	.brightness_set_blocking = &mute_led_sysfs_set,
-	.default_trigger = "audio-mute",
+// the background sampler only runs while it has consumers
+static void msi_ec_sampler_get(void);
+static void msi_ec_sampler_put(void);
+
+struct msi_ec_sensors {
+	ktime_t timestamp;
+	u8 value[MSI_EC_SENSOR_COUNT];
+	u8 valid; // bitmask of valid values
 };
 
-static struct led_classdev msiacpi_led_kbdlight = {
-	.name = "msiacpi::kbd_backlight",
-	.max_brightness = 3,
-	.flags = LED_BRIGHT_HW_CHANGED,
-	.brightness_set_blocking = &kbd_bl_sysfs_set,
-	.brightness_get = &kbd_bl_sysfs_get,
+struct msi_ec_histogram_state {
+	struct msi_ec_sensors prev; // held until the next sample
+	ktime_t reset;
+	u64 bucket_ns[MSI_EC_SENSOR_COUNT][MSI_EC_HIST_BUCKETS];
 };
 
-// ============================================================ //
-// Module load/unload
-// ============================================================ //
+static DEFINE_SPINLOCK(histograms_lock);
+static struct msi_ec_histogram_state histograms;
 
-// must be called before msi_platform_probe()
-static int __init load_configuration(void)
+static int msi_ec_sensor_address(enum msi_ec_sensor sensor)
 {
-	int result;
-
-	// get firmware version
-	u8 ver[MSI_EC_FW_VERSION_LENGTH + 1];
-	result = ec_get_firmware_version(ver);
-	if (result < 0) {
-		return result;
+	switch (sensor) {
+	case MSI_EC_SENSOR_CPU_TEMP:
+		return conf.cpu.rt_temp_address;
+	case MSI_EC_SENSOR_CPU_FAN:
+		return conf.cpu.rt_fan_speed_address;
+	case MSI_EC_SENSOR_GPU_TEMP:
+		return conf.gpu.rt_temp_address;
+	case MSI_EC_SENSOR_GPU_FAN:
+		return conf.gpu.rt_fan_speed_address;
+	case MSI_EC_SENSOR_COUNT:
+		break;
 	}
 
-	// load the suitable configuration, if exists
-	for (int i = 0; CONFIGURATIONS[i]; i++) {
-		if (match_string(CONFIGURATIONS[i]->allowed_fw, -1, ver) != -EINVAL) {
-			memcpy(&conf,
-			       CONFIGURATIONS[i],
-			       sizeof(struct msi_ec_conf));
-			conf.allowed_fw = NULL;
-			return 0;
-		}
-	}
+	return MSI_EC_ADDR_UNSUPP;
+}
 
-	pr_err("Your firmware version is not supported!\n");
-	return -EOPNOTSUPP;
+static void sensor_store(struct msi_ec_sensors *sensors,
+			 enum msi_ec_sensor sensor, u8 raw)
+{
+	if (sensor == MSI_EC_SENSOR_CPU_FAN &&
+	    cpu_fan_speed_percent(raw, &raw) < 0)
+		return;
+
+	sensors->value[sensor] = raw;
+	sensors->valid |= BIT(sensor);
 }
 
-static int __init msi_ec_init(void)
+// must be called with ec_lock held
+static void __sensor_read(struct msi_ec_sensors *sensors,
+			  enum msi_ec_sensor sensor)
 {
-	int result;
+	int address = msi_ec_sensor_address(sensor);
+	u8 rdata;
 
-	result = load_configuration();
-	if (result < 0)
-		return result;
+	if (address == MSI_EC_ADDR_UNSUPP)
+		return;
 
-	result = platform_driver_register(&msi_platform_driver);
-	if (result < 0)
-		return result;
+	if (__ec_read_fresh(address, &rdata) < 0)
+		return;
+
+	sensor_store(sensors, sensor, rdata);
+}
+
+// must be called with ec_lock held
+static void __sensors_read(struct msi_ec_sensors *sensors)
+{
+	sensors->timestamp = ktime_get();
+	sensors->valid = 0;
+
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++)
+		__sensor_read(sensors, i);
+}
+
+// previous values are weighted by the time they were held
+static void histograms_update(const struct msi_ec_sensors *sensors)
+{
+	struct msi_ec_sensors *prev = &histograms.prev;
+	unsigned long flags;
+	u64 elapsed;
+
+	spin_lock_irqsave(&histograms_lock, flags);
+
+	elapsed = ktime_to_ns(ktime_sub(sensors->timestamp, prev->timestamp));
+
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		int bucket;
+
+		if (!(prev->valid & BIT(i)))
+			continue;
+
+		bucket = min(prev->value[i] / MSI_EC_HIST_BUCKET_WIDTH,
+			     MSI_EC_HIST_BUCKETS - 1);
+		histograms.bucket_ns[i][bucket] += elapsed;
+	}
+
+	*prev = *sensors;
+
+	spin_unlock_irqrestore(&histograms_lock, flags);
+}
+
+// called when the sampler resumes after an idle period
+static void histograms_resume(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&histograms_lock, flags);
+	histograms.prev.valid = 0;
+	spin_unlock_irqrestore(&histograms_lock, flags);
+}
+
+// Histograms and history are collected from their first read on, the
+// sampler then keeps running for them
+static void stats_collect(void)
+{
+	static atomic_t collecting = ATOMIC_INIT(0);
+
+	if (!atomic_xchg(&collecting, 1))
+		msi_ec_sampler_get();
+}
+
+static void histograms_export(struct msi_ec_histograms *out, bool reset)
+{
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&histograms_lock, flags);
+
+	now = ktime_get();
+	out->time_ms = ktime_to_ms(ktime_sub(now, histograms.reset));
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++)
+		for (int j = 0; j < MSI_EC_HIST_BUCKETS; j++)
+			out->bucket_ms[i][j] = div_u64(histograms.bucket_ns[i][j],
+						       NSEC_PER_MSEC);
+
+	if (reset) {
+		memset(histograms.bucket_ns, 0, sizeof(histograms.bucket_ns));
+		histograms.reset = now;
+	}
+
+	spin_unlock_irqrestore(&histograms_lock, flags);
+}
+
+static ssize_t histograms_common_read(bool reset, char *buf, loff_t off,
+				      size_t count)
+{
+	struct msi_ec_histograms *data;
+
+	if (off >= sizeof(*data))
+		return 0;
+
+	// resetting is only allowed when everything is read at once
+	if (reset && (off != 0 || count < sizeof(*data)))
+		return -EINVAL;
+
+	data = kmalloc(sizeof(*data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	stats_collect();
+	histograms_export(data, reset);
+
+	count = min_t(size_t, count, sizeof(*data) - off);
+	memcpy(buf, (u8 *)data + off, count);
+	kfree(data);
+
+	return count;
+}
+
+static ssize_t histograms_read(struct file *filp, struct kobject *kobj,
+			       struct bin_attribute *attr, char *buf,
+			       loff_t off, size_t count)
+{
+	return histograms_common_read(false, buf, off, count);
+}
+
+static ssize_t histograms_reset_read(struct file *filp, struct kobject *kobj,
+				     struct bin_attribute *attr, char *buf,
+				     loff_t off, size_t count)
+{
+	return histograms_common_read(true, buf, off, count);
+}
+
+static BIN_ATTR_RO(histograms, sizeof(struct msi_ec_histograms));
+
+// 1 s x 120, 1 min x 120 and 1 h x 72: the header and the slots fit in
+// a single page, so one read returns all of them
+#define MSI_EC_HISTORY_SLOTS (120 + 120 + 72)
+
+static const struct {
+	u32 period_s;
+	u32 length;
+} history_tiers[MSI_EC_HISTORY_TIERS] = {
+	{ 1,    120 },
+	{ 60,   120 },
+	{ 3600, 72  },
+};
+
+struct msi_ec_history_acc {
+	bool started;
+	u64 window;
+	u32 samples[MSI_EC_SENSOR_COUNT];
+	u32 sum[MSI_EC_SENSOR_COUNT];
+	u8 min[MSI_EC_SENSOR_COUNT];
+	u8 max[MSI_EC_SENSOR_COUNT];
+};
+
+static DEFINE_SEQLOCK(history_lock);
+static struct msi_ec_history_header history_header;
+static struct msi_ec_history_acc history_acc[MSI_EC_HISTORY_TIERS];
+static struct msi_ec_history_slot history_slots[MSI_EC_HISTORY_SLOTS][MSI_EC_SENSOR_COUNT];
+
+#define MSI_EC_HISTORY_SIZE (sizeof(history_header) + sizeof(history_slots))
+
+static void __init history_init(void)
+{
+	BUILD_BUG_ON(MSI_EC_HISTORY_SIZE > 4096);
+
+	history_header.tier_count = MSI_EC_HISTORY_TIERS;
+	history_header.sensor_count = MSI_EC_SENSOR_COUNT;
+
+	for (int t = 0; t < MSI_EC_HISTORY_TIERS; t++) {
+		history_header.tier[t].period_s = history_tiers[t].period_s;
+		history_header.tier[t].length = history_tiers[t].length;
+	}
+}
+
+// must be called with history_lock held, a NULL acc pushes an empty window
+static void __history_push(int tier, const struct msi_ec_history_acc *acc)
+{
+	struct msi_ec_history_tier *header = &history_header.tier[tier];
+	struct msi_ec_history_slot *slots;
+	int first = 0;
+
+	for (int t = 0; t < tier; t++)
+		first += history_tiers[t].length;
+
+	slots = history_slots[first + header->head];
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if (!acc || !acc->samples[i]) {
+			slots[i] = (struct msi_ec_history_slot){ 0xff, 0, 0 };
+			continue;
+		}
+
+		slots[i].min = acc->min[i];
+		slots[i].max = acc->max[i];
+		slots[i].avg = acc->sum[i] / acc->samples[i];
+	}
+
+	header->head = (header->head + 1) % header->length;
+	if (header->count < header->length)
+		header->count++;
+}
+
+static void history_update(const struct msi_ec_sensors *sensors)
+{
+	u64 seconds = div_u64(ktime_to_ns(sensors->timestamp), NSEC_PER_SEC);
+	unsigned long flags;
+
+	write_seqlock_irqsave(&history_lock, flags);
+
+	for (int t = 0; t < MSI_EC_HISTORY_TIERS; t++) {
+		struct msi_ec_history_acc *acc = &history_acc[t];
+		u64 window = div_u64(seconds, history_tiers[t].period_s);
+
+		if (!acc->started || window != acc->window) {
+			if (acc->started) {
+				u64 gap = min_t(u64, window - acc->window - 1,
+						history_tiers[t].length);
+
+				__history_push(t, acc);
+				while (gap--)
+					__history_push(t, NULL);
+				history_header.tier[t].window = window - 1;
+			}
+
+			memset(acc, 0, sizeof(*acc));
+			memset(acc->min, 0xff, sizeof(acc->min));
+			acc->started = true;
+			acc->window = window;
+		}
+
+		for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+			u8 value = sensors->value[i];
+
+			if (!(sensors->valid & BIT(i)))
+				continue;
+
+			acc->samples[i]++;
+			acc->sum[i] += value;
+			acc->min[i] = min(acc->min[i], value);
+			acc->max[i] = max(acc->max[i], value);
+		}
+	}
+
+	write_sequnlock_irqrestore(&history_lock, flags);
+}
+
+// Every read copies its range directly, retrying while the sampler
+// updates the rings; a read of the whole size is consistent
+static ssize_t history_read(struct file *filp, struct kobject *kobj,
+			    struct bin_attribute *attr, char *buf,
+			    loff_t off, size_t count)
+{
+	const size_t header_size = sizeof(history_header);
+	unsigned int seq;
+	size_t head;
+
+	if (off >= attr->size)
+		return 0;
+	count = min_t(size_t, count, attr->size - off);
+
+	stats_collect();
+
+	// the part of the range that falls in the header
+	head = off < header_size ? min_t(size_t, count, header_size - off) : 0;
+
+	do {
+		seq = read_seqbegin(&history_lock);
+
+		if (head)
+			memcpy(buf, (u8 *)&history_header + off, head);
+		if (count > head)
+			memcpy(buf + head,
+			       (u8 *)history_slots + off + head - header_size,
+			       count - head);
+	} while (read_seqretry(&history_lock, seq));
+
+	return count;
+}
+
+static BIN_ATTR_RO(history, MSI_EC_HISTORY_SIZE);
+
+
+static struct bin_attribute bin_attr_histograms_reset = {
+	.attr = {
+		.name = "histograms_reset",
+		.mode = 0400,
+	},
+	.size = sizeof(struct msi_ec_histograms),
+	.read = histograms_reset_read,
+};
+
+static struct bin_attribute *msi_stats_bin_attrs[] = {
+	&bin_attr_histograms,
+	&bin_attr_histograms_reset,
+	&bin_attr_history,
+	NULL
+};
+
+static const struct attribute_group msi_stats_group = {
+	.bin_attrs = msi_stats_bin_attrs,
+};
+
+// ============================================================ //
+// Sysfs platform device attributes (fan curve)
+// ============================================================ //
+
+#define MSI_EC_FAN_CURVE_TEMP_MAX 100
+
+// None of the configurations has verified curve registers yet, so the
+// fan_curve attribute is inert until they are given explicitly:
+// cpu_temp,cpu_speed,speed_max[,gpu_temp,gpu_speed]
+static int fan_curve_layout[5];
+static int fan_curve_layout_count;
+module_param_array(fan_curve_layout, int, &fan_curve_layout_count, 0444);
+MODULE_PARM_DESC(fan_curve_layout,
+		 "Fan curve registers as cpu_temp,cpu_speed,speed_max[,gpu_temp,gpu_speed] (see fan_curve)");
+
+static bool __init fan_curve_layout_valid(void)
+{
+	// temperatures and speeds alternate in the parameter
+	static const int lengths[] = {
+		MSI_EC_FAN_CURVE_TEMPS, MSI_EC_FAN_CURVE_SPEEDS, 0,
+		MSI_EC_FAN_CURVE_TEMPS, MSI_EC_FAN_CURVE_SPEEDS,
+	};
+
+	if (fan_curve_layout_count != 3 && fan_curve_layout_count != 5)
+		return false;
+
+	if (fan_curve_layout[2] < 1 || fan_curve_layout[2] > 0xff)
+		return false;
+
+	for (int i = 0; i < fan_curve_layout_count; i++) {
+		if (!lengths[i])
+			continue;
+
+		if (fan_curve_layout[i] < 0 ||
+		    fan_curve_layout[i] + lengths[i] > 0x100)
+			return false;
+	}
+
+	return true;
+}
+
+static void __init fan_curve_init(void)
+{
+	if (!fan_curve_layout_count)
+		return;
+
+	if (!fan_curve_layout_valid()) {
+		pr_warn("ignoring invalid fan_curve_layout\n");
+		return;
+	}
+
+	conf.fan_curve.cpu_temp_address = fan_curve_layout[0];
+	conf.fan_curve.cpu_speed_address = fan_curve_layout[1];
+	conf.fan_curve.speed_max = fan_curve_layout[2];
+
+	if (fan_curve_layout_count == 5) {
+		conf.fan_curve.gpu_temp_address = fan_curve_layout[3];
+		conf.fan_curve.gpu_speed_address = fan_curve_layout[4];
+	} else {
+		conf.fan_curve.gpu_temp_address = MSI_EC_ADDR_UNSUPP;
+		conf.fan_curve.gpu_speed_address = MSI_EC_ADDR_UNSUPP;
+	}
+}
+
+// register of a byte of struct msi_ec_fan_curve
+static int fan_curve_address(int index)
+{
+	const struct {
+		int address;
+		int offset;
+		int length;
+	} blocks[] = {
+		{ conf.fan_curve.cpu_temp_address,
+		  offsetof(struct msi_ec_fan_curve, cpu_temp), MSI_EC_FAN_CURVE_TEMPS },
+		{ conf.fan_curve.cpu_speed_address,
+		  offsetof(struct msi_ec_fan_curve, cpu_speed), MSI_EC_FAN_CURVE_SPEEDS },
+		{ conf.fan_curve.gpu_temp_address,
+		  offsetof(struct msi_ec_fan_curve, gpu_temp), MSI_EC_FAN_CURVE_TEMPS },
+		{ conf.fan_curve.gpu_speed_address,
+		  offsetof(struct msi_ec_fan_curve, gpu_speed), MSI_EC_FAN_CURVE_SPEEDS },
+	};
+
+	for (int i = 0; i < ARRAY_SIZE(blocks); i++) {
+		if (index >= blocks[i].offset + blocks[i].length)
+			continue;
+
+		if (blocks[i].address == MSI_EC_ADDR_UNSUPP)
+			return MSI_EC_ADDR_UNSUPP;
+
+		return blocks[i].address + index - blocks[i].offset;
+	}
+
+	return MSI_EC_ADDR_UNSUPP;
+}
+
+static int fan_curve_validate(const u8 *temp, const u8 *speed)
+{
+	for (int i = 0; i < MSI_EC_FAN_CURVE_TEMPS; i++) {
+		if (temp[i] > MSI_EC_FAN_CURVE_TEMP_MAX)
+			return -EINVAL;
+
+		if (i > 0 && temp[i] < temp[i - 1])
+			return -EINVAL;
+	}
+
+	for (int i = 0; i < MSI_EC_FAN_CURVE_SPEEDS; i++) {
+		if (speed[i] > conf.fan_curve.speed_max)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static ssize_t fan_curve_read(struct file *filp, struct kobject *kobj,
+			      struct bin_attribute *attr, char *buf,
+			      loff_t off, size_t count)
+{
+	struct msi_ec_fan_curve curve = { 0 };
+	u8 *bytes = (u8 *)&curve;
+	int result = 0;
+
+	if (off >= sizeof(curve))
+		return 0;
+	count = min_t(size_t, count, sizeof(curve) - off);
+
+	mutex_lock(&ec_lock);
+	for (int i = off; i < off + count; i++) {
+		int address = fan_curve_address(i);
+
+		if (address == MSI_EC_ADDR_UNSUPP)
+			continue;
+
+		result = __ec_read_cached(address, &bytes[i]);
+		if (result < 0)
+			break;
+	}
+	mutex_unlock(&ec_lock);
+
+	if (result < 0)
+		return result;
+
+	memcpy(buf, bytes + off, count);
+	return count;
+}
+
+// The EC has no block write, so the whole curve is committed with
+// single byte writes under one ec_lock hold, skipping unchanged bytes
+static ssize_t fan_curve_write(struct file *filp, struct kobject *kobj,
+			       struct bin_attribute *attr, char *buf,
+			       loff_t off, size_t count)
+{
+	struct msi_ec_fan_curve curve;
+	const u8 *bytes = (const u8 *)&curve;
+	int result = 0;
+	u8 stored;
+
+	if (off != 0 || count != sizeof(curve))
+		return -EINVAL;
+
+	memcpy(&curve, buf, sizeof(curve));
+
+	result = fan_curve_validate(curve.cpu_temp, curve.cpu_speed);
+	if (result < 0)
+		return result;
+
+	if (conf.fan_curve.gpu_temp_address != MSI_EC_ADDR_UNSUPP) {
+		result = fan_curve_validate(curve.gpu_temp, curve.gpu_speed);
+		if (result < 0)
+			return result;
+	}
+
+	mutex_lock(&ec_lock);
+	for (int i = 0; i < sizeof(curve); i++) {
+		int address = fan_curve_address(i);
+
+		if (address == MSI_EC_ADDR_UNSUPP)
+			continue;
+
+		result = __ec_read_cached(address, &stored);
+		if (result < 0)
+			break;
+
+		if (stored == bytes[i])
+			continue;
+
+		result = __ec_write(address, bytes[i]);
+		if (result < 0)
+			break;
+	}
+	mutex_unlock(&ec_lock);
+
+	if (result < 0)
+		return result;
+
+	return count;
+}
+
+static BIN_ATTR_RW(fan_curve, sizeof(struct msi_ec_fan_curve));
+
+static struct bin_attribute *msi_fan_curve_bin_attrs[] = {
+	&bin_attr_fan_curve,
+	NULL
+};
+
+static umode_t msi_fan_curve_is_visible(struct kobject *kobj,
+					struct bin_attribute *attr, int n)
+{
+	if (conf.fan_curve.cpu_temp_address == MSI_EC_ADDR_UNSUPP ||
+	    conf.fan_curve.cpu_speed_address == MSI_EC_ADDR_UNSUPP ||
+	    !conf.fan_curve.speed_max)
+		return 0;
+
+	return attr->attr.mode;
+}
+
+static const struct attribute_group msi_fan_curve_group = {
+	.bin_attrs = msi_fan_curve_bin_attrs,
+	.is_bin_visible = msi_fan_curve_is_visible,
+};
+
+// ============================================================ //
+// IIO device
+// ============================================================ //
+
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+
+// temperatures are in milli celsius, fan speeds in milli percent
+#define MSI_EC_IIO_CHANNEL(_type, _channel, _sensor) {			\
+	.type = _type,							\
+	.indexed = 1,							\
+	.channel = _channel,						\
+	.address = _sensor,						\
+	.scan_index = _sensor,						\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |			\
+			      BIT(IIO_CHAN_INFO_SCALE),			\
+	.scan_type = {							\
+		.sign = 'u',						\
+		.realbits = 8,						\
+		.storagebits = 8,					\
+	},								\
+}
+
+static const struct iio_chan_spec msi_ec_iio_channels[] = {
+	MSI_EC_IIO_CHANNEL(IIO_TEMP, 0, MSI_EC_SENSOR_CPU_TEMP),
+	MSI_EC_IIO_CHANNEL(IIO_POSITIONRELATIVE, 0, MSI_EC_SENSOR_CPU_FAN),
+	MSI_EC_IIO_CHANNEL(IIO_TEMP, 1, MSI_EC_SENSOR_GPU_TEMP),
+	MSI_EC_IIO_CHANNEL(IIO_POSITIONRELATIVE, 1, MSI_EC_SENSOR_GPU_FAN),
+	IIO_CHAN_SOFT_TIMESTAMP(MSI_EC_SENSOR_COUNT),
+};
+
+static int msi_ec_iio_read_raw(struct iio_dev *indio_dev,
+			       struct iio_chan_spec const *chan,
+			       int *val, int *val2, long mask)
+{
+	struct msi_ec_sensors sensors = { 0 };
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		mutex_lock(&ec_lock);
+		__sensor_read(&sensors, chan->address);
+		mutex_unlock(&ec_lock);
+
+		if (!(sensors.valid & BIT(chan->address)))
+			return -EIO;
+
+		*val = sensors.value[chan->address];
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		*val = 1000;
+		return IIO_VAL_INT;
+	}
+
+	return -EINVAL;
+}
+
+static int msi_ec_iio_read_label(struct iio_dev *indio_dev,
+				 struct iio_chan_spec const *chan, char *label)
+{
+	return sysfs_emit(label, "%s\n", chan->channel ? "gpu" : "cpu");
+}
+
+static const struct iio_info msi_ec_iio_info = {
+	.read_raw = msi_ec_iio_read_raw,
+	.read_label = msi_ec_iio_read_label,
+};
+
+static irqreturn_t msi_ec_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct msi_ec_sensors sensors = { 0 };
+	struct {
+		u8 value[MSI_EC_SENSOR_COUNT];
+		s64 timestamp __aligned(8);
+	} scan = { 0 };
+	int n = 0;
+
+	mutex_lock(&ec_lock);
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if (test_bit(i, indio_dev->active_scan_mask))
+			__sensor_read(&sensors, i);
+	}
+	mutex_unlock(&ec_lock);
+
+	// enabled channels are packed in scan index order
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if (test_bit(i, indio_dev->active_scan_mask))
+			scan.value[n++] = sensors.value[i];
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &scan, pf->timestamp);
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int msi_ec_iio_setup(struct device *dev)
+{
+	struct iio_chan_spec *channels;
+	struct iio_dev *indio_dev;
+	int count = 0;
+	int result;
+
+	indio_dev = devm_iio_device_alloc(dev, 0);
+	if (!indio_dev)
+		return -ENOMEM;
+
+	// expose the sensors of the current configuration only
+	channels = devm_kcalloc(dev, ARRAY_SIZE(msi_ec_iio_channels),
+				sizeof(*channels), GFP_KERNEL);
+	if (!channels)
+		return -ENOMEM;
+
+	for (int i = 0; i < ARRAY_SIZE(msi_ec_iio_channels); i++) {
+		const struct iio_chan_spec *chan = &msi_ec_iio_channels[i];
+
+		if (chan->type != IIO_TIMESTAMP &&
+		    msi_ec_sensor_address(chan->address) == MSI_EC_ADDR_UNSUPP)
+			continue;
+
+		channels[count++] = *chan;
+	}
+
+	indio_dev->name = MSI_EC_DRIVER_NAME;
+	indio_dev->info = &msi_ec_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = channels;
+	indio_dev->num_channels = count;
+
+	result = devm_iio_triggered_buffer_setup(dev, indio_dev,
+						 iio_pollfunc_store_time,
+						 msi_ec_iio_trigger_handler,
+						 NULL);
+	if (result < 0)
+		return result;
+
+	return devm_iio_device_register(dev, indio_dev);
+}
+
+#else
+
+static int msi_ec_iio_setup(struct device *dev)
+{
+	return 0;
+}
+
+#endif // CONFIG_IIO_TRIGGERED_BUFFER
+
+// ============================================================ //
+// Hwmon device
+// ============================================================ //
+
+#if IS_ENABLED(CONFIG_HWMON)
+
+// pwmN_enable values, full speed (0) is left to cooler_boost
+static const char *msi_ec_pwm_mode_name(long enable)
+{
+	switch (enable) {
+	case 1:
+		return FM_BASIC_NAME;
+	case 2:
+		return FM_AUTO_NAME;
+	case 3:
+		return FM_ADVANCED_NAME;
+	case 4:
+		return FM_SILENT_NAME;
+	}
+
+	return NULL;
+}
+
+struct msi_ec_pwm_conf {
+	int address;
+	int base_min;
+	int base_max;
+};
+
+// pwm1 is the cpu fan, pwm2 the gpu fan
+static void msi_ec_pwm_conf(int channel, struct msi_ec_pwm_conf *pwm)
+{
+	if (channel == 0) {
+		pwm->address = conf.cpu.bs_fan_speed_address;
+		pwm->base_min = conf.cpu.bs_fan_speed_base_min;
+		pwm->base_max = conf.cpu.bs_fan_speed_base_max;
+	} else {
+		pwm->address = conf.gpu.bs_fan_speed_address;
+		pwm->base_min = conf.gpu.bs_fan_speed_base_min;
+		pwm->base_max = conf.gpu.bs_fan_speed_base_max;
+	}
+}
+
+static int msi_ec_pwm_enable_read(long *val)
+{
+	const char *name = NULL;
+	u8 rdata;
+	int result;
+
+	result = ec_read_cached(conf.fan_mode.address, &rdata);
+	if (result < 0)
+		return result;
+
+	for (int i = 0; conf.fan_mode.modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		if (rdata == conf.fan_mode.modes[i].value)
+			name = conf.fan_mode.modes[i].name;
+	}
+
+	for (long enable = 1; name && msi_ec_pwm_mode_name(enable); enable++) {
+		if (strcmp(msi_ec_pwm_mode_name(enable), name) == 0) {
+			*val = enable;
+			return 0;
+		}
+	}
+
+	return -ENODATA;
+}
+
+static int msi_ec_pwm_enable_write(long val)
+{
+	const char *name = msi_ec_pwm_mode_name(val);
+
+	if (!name)
+		return -EINVAL;
+
+	for (int i = 0; conf.fan_mode.modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		if (strcmp(conf.fan_mode.modes[i].name, name) == 0)
+			return ec_write_through(conf.fan_mode.address,
+						conf.fan_mode.modes[i].value);
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static int msi_ec_hwmon_read(struct device *dev,
+			     enum hwmon_sensor_types type,
+			     u32 attr, int channel, long *val)
+{
+	struct msi_ec_pwm_conf pwm;
+	u8 rdata;
+	int result;
+
+	if (type != hwmon_pwm)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+	case hwmon_pwm_enable:
+		return msi_ec_pwm_enable_read(val);
+	case hwmon_pwm_input:
+		msi_ec_pwm_conf(channel, &pwm);
+
+		result = ec_read_cached(pwm.address, &rdata);
+		if (result < 0)
+			return result;
+
+		rdata = clamp_t(int, rdata, pwm.base_min, pwm.base_max);
+		*val = DIV_ROUND_CLOSEST((rdata - pwm.base_min) * 255,
+					 pwm.base_max - pwm.base_min);
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static int msi_ec_hwmon_write(struct device *dev,
+			      enum hwmon_sensor_types type,
+			      u32 attr, int channel, long val)
+{
+	struct msi_ec_pwm_conf pwm;
+
+	if (type != hwmon_pwm)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+	case hwmon_pwm_enable:
+		return msi_ec_pwm_enable_write(val);
+	case hwmon_pwm_input:
+		if (val < 0 || val > 255)
+			return -EINVAL;
+
+		msi_ec_pwm_conf(channel, &pwm);
+
+		return ec_write_through(pwm.address, pwm.base_min +
+					DIV_ROUND_CLOSEST(val * (pwm.base_max - pwm.base_min),
+							  255));
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static umode_t msi_ec_hwmon_is_visible(const void *data,
+				       enum hwmon_sensor_types type,
+				       u32 attr, int channel)
+{
+	struct msi_ec_pwm_conf pwm;
+
+	if (type != hwmon_pwm)
+		return 0;
+
+	msi_ec_pwm_conf(channel, &pwm);
+	if (pwm.address == MSI_EC_ADDR_UNSUPP)
+		return 0;
+
+	if (attr == hwmon_pwm_enable &&
+	    conf.fan_mode.address == MSI_EC_ADDR_UNSUPP)
+		return 0;
+
+	return 0644;
+}
+
+static const struct hwmon_ops msi_ec_hwmon_ops = {
+	.is_visible = msi_ec_hwmon_is_visible,
+	.read = msi_ec_hwmon_read,
+	.write = msi_ec_hwmon_write,
+};
+
+// the fan mode is shared, both pwmN_enable attributes reflect it
+static const struct hwmon_channel_info *msi_ec_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(pwm,
+			   HWMON_PWM_INPUT | HWMON_PWM_ENABLE,
+			   HWMON_PWM_INPUT | HWMON_PWM_ENABLE),
+	NULL
+};
+
+static const struct hwmon_chip_info msi_ec_hwmon_chip_info = {
+	.ops = &msi_ec_hwmon_ops,
+	.info = msi_ec_hwmon_info,
+};
+
+static int msi_ec_hwmon_setup(struct device *dev)
+{
+	struct device *hwmon;
+
+	if (conf.cpu.bs_fan_speed_address == MSI_EC_ADDR_UNSUPP &&
+	    conf.gpu.bs_fan_speed_address == MSI_EC_ADDR_UNSUPP)
+		return 0;
+
+	hwmon = devm_hwmon_device_register_with_info(dev, "msi_ec", NULL,
+						     &msi_ec_hwmon_chip_info,
+						     NULL);
+
+	return PTR_ERR_OR_ZERO(hwmon);
+}
+
+#else
+
+static int msi_ec_hwmon_setup(struct device *dev)
+{
+	return 0;
+}
+
+#endif // CONFIG_HWMON
+
+// ============================================================ //
+// Sysfs platform device attributes (residency)
+// ============================================================ //
+
+// one "<state> <time_ms> <entries>" line per state, then the transitions
+static ssize_t residency_emit(const struct msi_ec_residency *residency,
+			      const char *names[MSI_EC_RESIDENCY_STATES],
+			      char *buf)
+{
+	struct msi_ec_residency copy;
+	unsigned long flags;
+	ktime_t now;
+	int result;
+	int count = 0;
+
+	spin_lock_irqsave(&residency_lock, flags);
+	copy = *residency;
+	now = ktime_get();
+	spin_unlock_irqrestore(&residency_lock, flags);
+
+	// account the time spent in the current state so far
+	if (copy.state >= 0)
+		copy.time_ns[copy.state] += ktime_to_ns(ktime_sub(now, copy.entered));
+
+	for (int i = 0; i < MSI_EC_RESIDENCY_STATES; i++) {
+		if (!names[i])
+			continue;
+
+		result = sysfs_emit_at(buf, count, "%s %llu %llu\n", names[i],
+				       div_u64(copy.time_ns[i], NSEC_PER_MSEC),
+				       copy.entries[i]);
+		if (result < 0)
+			return result;
+		count += result;
+	}
+
+	result = sysfs_emit_at(buf, count, "transitions %llu\n", copy.transitions);
+	if (result < 0)
+		return result;
+
+	return count + result;
+}
+
+static ssize_t residency_modes_emit(const struct msi_ec_residency *residency,
+				    const struct msi_ec_mode *modes, char *buf)
+{
+	const char *names[MSI_EC_RESIDENCY_STATES] = { NULL };
+
+	for (int i = 0; modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		names[i] = modes[i].name;
+	}
+	names[MSI_EC_RESIDENCY_UNKNOWN] = "unknown";
+
+	return residency_emit(residency, names, buf);
+}
+
+static ssize_t residency_shift_mode_show(struct device *device,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	return residency_modes_emit(&shift_mode_residency,
+				    conf.shift_mode.modes, buf);
+}
+
+static ssize_t residency_fan_mode_show(struct device *device,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	return residency_modes_emit(&fan_mode_residency,
+				    conf.fan_mode.modes, buf);
+}
+
+static ssize_t residency_cooler_boost_show(struct device *device,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	const char *names[MSI_EC_RESIDENCY_STATES] = { "off", "on" };
+
+	return residency_emit(&cooler_boost_residency, names, buf);
+}
+
+static struct device_attribute dev_attr_residency_shift_mode = {
+	.attr = {
+		.name = "shift_mode",
+		.mode = 0444,
+	},
+	.show = residency_shift_mode_show,
+};
+
+static struct device_attribute dev_attr_residency_fan_mode = {
+	.attr = {
+		.name = "fan_mode",
+		.mode = 0444,
+	},
+	.show = residency_fan_mode_show,
+};
+
+static struct device_attribute dev_attr_residency_cooler_boost = {
+	.attr = {
+		.name = "cooler_boost",
+		.mode = 0444,
+	},
+	.show = residency_cooler_boost_show,
+};
+
+static struct attribute *msi_residency_attrs[] = {
+	&dev_attr_residency_shift_mode.attr,
+	&dev_attr_residency_fan_mode.attr,
+	&dev_attr_residency_cooler_boost.attr,
+	NULL
+};
+
+static umode_t msi_residency_is_visible(struct kobject *kobj,
+					struct attribute *attr, int index)
+{
+	if (attr == &dev_attr_residency_shift_mode.attr)
+		return conf.shift_mode.address != MSI_EC_ADDR_UNSUPP ? attr->mode : 0;
+
+	if (attr == &dev_attr_residency_fan_mode.attr)
+		return conf.fan_mode.address != MSI_EC_ADDR_UNSUPP ? attr->mode : 0;
+
+	if (attr == &dev_attr_residency_cooler_boost.attr)
+		return conf.cooler_boost.address != MSI_EC_ADDR_UNSUPP ? attr->mode : 0;
+
+	return attr->mode;
+}
+
+static const struct attribute_group msi_residency_group = {
+	.name = "residency",
+	.attrs = msi_residency_attrs,
+	.is_visible = msi_residency_is_visible,
+};
+
+static struct attribute_group msi_root_group;
+
+static const struct attribute_group *msi_platform_groups[] = {
+	&msi_root_group,
+	&msi_cpu_group,
+	&msi_gpu_group,
+	&msi_residency_group,
+	&msi_stats_group,
+	&msi_fan_curve_group,
+	NULL
+};
+
+static int msi_platform_probe(struct platform_device *pdev)
+{
+	int result;
+
+	// ALL root attributes and their support flags
+	struct attribute_support msi_root_attrs_support[] = {
+		{
+			&dev_attr_webcam.attr,
+			conf.webcam.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_webcam_block.attr,
+			conf.webcam.block_address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_fn_key.attr,
+			conf.fn_win_swap.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_win_key.attr,
+			conf.fn_win_swap.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_battery_mode.attr,
+			conf.charge_control.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_cooler_boost.attr,
+			conf.cooler_boost.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_cooler_boost_remaining.attr,
+			conf.cooler_boost.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_available_shift_modes.attr,
+			conf.shift_mode.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_shift_mode.attr,
+			conf.shift_mode.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_super_battery.attr,
+			conf.super_battery.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_available_fan_modes.attr,
+			conf.fan_mode.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_fan_mode.attr,
+			conf.fan_mode.address != MSI_EC_ADDR_UNSUPP,
+		},
+		{
+			&dev_attr_fw_version.attr,
+			true,
+		},
+		{
+			&dev_attr_fw_release_date.attr,
+			true,
+		},
+	};
+
+	const int attributes_count =
+		sizeof(msi_root_attrs_support) / sizeof(msi_root_attrs_support[0]);
+
+	// supported root attributes
+	struct attribute **msi_root_attrs =
+		kcalloc(attributes_count + 1, sizeof(struct attribute *), GFP_KERNEL);
+	if (!msi_root_attrs)
+		return -ENOMEM;
+
+	// copy supported attributes only
+	for (int i = 0, j = 0; i < attributes_count; i++) {
+		if (msi_root_attrs_support[i].supported)
+			msi_root_attrs[j++] = msi_root_attrs_support[i].attribute;
+	}
+
+	// save attributes in the group
+	msi_root_group.attrs = msi_root_attrs;
+
+	result = sysfs_create_groups(&pdev->dev.kobj, msi_platform_groups);
+	if (result < 0)
+		return result;
+
+	// IIO capture is optional, the sysfs attributes work without it
+	result = msi_ec_iio_setup(&pdev->dev);
+	if (result < 0)
+		dev_warn(&pdev->dev, "IIO device is unavailable (%d)\n", result);
+
+	result = msi_ec_hwmon_setup(&pdev->dev);
+	if (result < 0)
+		dev_warn(&pdev->dev, "hwmon device is unavailable (%d)\n", result);
+
+	return 0;
+}
+
+static int msi_platform_remove(struct platform_device *pdev)
+{
+	sysfs_remove_groups(&pdev->dev.kobj, msi_platform_groups);
+	kfree(msi_root_group.attrs);
+	return 0;
+}
+
+static struct platform_device *msi_platform_device;
+
+static struct platform_driver msi_platform_driver = {
+	.driver = {
+		.name = MSI_EC_DRIVER_NAME,
+	},
+	.probe = msi_platform_probe,
+	.remove = msi_platform_remove,
+};
+
+// ============================================================ //
+// Sysfs leds subsystem
+// ============================================================ //
+
+static int micmute_led_sysfs_set(struct led_classdev *led_cdev,
+				 enum led_brightness brightness)
+{
+	int result;
+
+	if (brightness) {
+		result = ec_set_bit(conf.leds.micmute_led_address, conf.leds.bit);
+	} else {
+		result = ec_unset_bit(conf.leds.micmute_led_address, conf.leds.bit);
+	}
+
+	if (result < 0)
+		return result;
+
+	return 0;
+}
+
+static int mute_led_sysfs_set(struct led_classdev *led_cdev,
+			      enum led_brightness brightness)
+{
+	int result;
+
+	if (brightness) {
+		result = ec_set_bit(conf.leds.mute_led_address, conf.leds.bit);
+	} else {
+		result = ec_unset_bit(conf.leds.mute_led_address, conf.leds.bit);
+	}
+
+	if (result < 0)
+		return result;
+
+	return 0;
+}
+
+static enum led_brightness kbd_bl_sysfs_get(struct led_classdev *led_cdev)
+{
+	u8 rdata;
+	int result = ec_read_cached(conf.kbd_bl.bl_state_address, &rdata);
+	if (result < 0)
+		return 0;
+	return rdata & MSI_EC_KBD_BL_STATE_MASK;
+}
+
+static int kbd_bl_sysfs_set(struct led_classdev *led_cdev,
+			    enum led_brightness brightness)
+{
+	u8 wdata;
+	if (brightness < 0 || brightness > 3)
+		return -1;
+	wdata = conf.kbd_bl.state_base_value | brightness;
+	return ec_write_through(conf.kbd_bl.bl_state_address, wdata);
+}
+
+static struct led_classdev micmute_led_cdev = {
+	.name = "platform::micmute",
+	.max_brightness = 1,
+	.brightness_set_blocking = &micmute_led_sysfs_set,
+	.default_trigger = "audio-micmute",
+};
+
+static struct led_classdev mute_led_cdev = {
+	.name = "platform::mute",
+	.max_brightness = 1,
+	.brightness_set_blocking = &mute_led_sysfs_set,
+	.default_trigger = "audio-mute",
+};
+
+static struct led_classdev msiacpi_led_kbdlight = {
+	.name = "msiacpi::kbd_backlight",
+	.max_brightness = 3,
+	.flags = LED_BRIGHT_HW_CHANGED,
+	.brightness_set_blocking = &kbd_bl_sysfs_set,
+	.brightness_get = &kbd_bl_sysfs_get,
+};
+
+// ============================================================ //
+// Sample stream chardev
+// ============================================================ //
+
+#define MSI_EC_STREAM_SIZE 1024 // records, must be a power of 2
+
+// Written by the sampler only, readers validate each record by its seq,
+// which is set to U64_MAX while the slot is being rewritten
+static struct msi_ec_sample stream_ring[MSI_EC_STREAM_SIZE];
+static u64 stream_head; // seq of the next record
+static DECLARE_WAIT_QUEUE_HEAD(stream_wait);
+
+struct msi_ec_stream_reader {
+	struct mutex lock;
+	u64 cursor;
+	u64 overruns;
+	bool sampling; // holds the sampler, from the first read or poll
+};
+
+static void stream_push(const struct msi_ec_sample *sample)
+{
+	u64 seq = stream_head;
+	struct msi_ec_sample *slot = &stream_ring[seq & (MSI_EC_STREAM_SIZE - 1)];
+	struct msi_ec_sample record = *sample;
+
+	record.seq = U64_MAX;
+
+	WRITE_ONCE(slot->seq, U64_MAX);
+	smp_wmb();
+	*slot = record;
+	smp_wmb();
+	WRITE_ONCE(slot->seq, seq);
+
+	smp_store_release(&stream_head, seq + 1);
+	wake_up_interruptible(&stream_wait);
+}
+
+// returns false if the record has been overwritten
+static bool stream_fetch(u64 seq, struct msi_ec_sample *record)
+{
+	const struct msi_ec_sample *slot =
+		&stream_ring[seq & (MSI_EC_STREAM_SIZE - 1)];
+
+	if (smp_load_acquire(&slot->seq) != seq)
+		return false;
+
+	*record = *slot;
+	smp_rmb();
+
+	return READ_ONCE(slot->seq) == seq;
+}
+
+static int stream_open(struct inode *inode, struct file *file)
+{
+	struct msi_ec_stream_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	mutex_init(&reader->lock);
+	reader->cursor = smp_load_acquire(&stream_head);
+	file->private_data = reader;
+
+	return nonseekable_open(inode, file);
+}
+
+static int stream_release(struct inode *inode, struct file *file)
+{
+	struct msi_ec_stream_reader *reader = file->private_data;
+
+	if (reader->sampling)
+		msi_ec_sampler_put();
+
+	kfree(reader);
+	return 0;
+}
+
+// files only opened for the ioctls do not start the sampler
+static void stream_start(struct msi_ec_stream_reader *reader)
+{
+	mutex_lock(&reader->lock);
+	if (!reader->sampling) {
+		reader->sampling = true;
+		msi_ec_sampler_get();
+	}
+	mutex_unlock(&reader->lock);
+}
+
+// returns every record produced since the previous read
+static ssize_t stream_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	struct msi_ec_stream_reader *reader = file->private_data;
+	struct msi_ec_sample record;
+	size_t copied = 0;
+	ssize_t result;
+	u64 head;
+
+	if (count < sizeof(record))
+		return -EINVAL;
+
+	stream_start(reader);
+	mutex_lock(&reader->lock);
+
+	while (smp_load_acquire(&stream_head) == reader->cursor) {
+		mutex_unlock(&reader->lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		result = wait_event_interruptible(stream_wait,
+			smp_load_acquire(&stream_head) != READ_ONCE(reader->cursor));
+		if (result < 0)
+			return result;
+
+		mutex_lock(&reader->lock);
+	}
+
+	while (copied + sizeof(record) <= count) {
+		head = smp_load_acquire(&stream_head);
+		if (head == reader->cursor)
+			break;
+
+		// the oldest records are gone
+		if (head - reader->cursor > MSI_EC_STREAM_SIZE) {
+			reader->overruns += head - reader->cursor - MSI_EC_STREAM_SIZE;
+			reader->cursor = head - MSI_EC_STREAM_SIZE;
+		}
+
+		if (!stream_fetch(reader->cursor, &record)) {
+			reader->overruns++;
+			reader->cursor++;
+			continue;
+		}
+
+		if (copy_to_user(buf + copied, &record, sizeof(record))) {
+			if (!copied)
+				copied = -EFAULT;
+			break;
+		}
+
+		copied += sizeof(record);
+		reader->cursor++;
+	}
+
+	mutex_unlock(&reader->lock);
+	return copied;
+}
+
+static __poll_t stream_poll(struct file *file, poll_table *wait)
+{
+	struct msi_ec_stream_reader *reader = file->private_data;
+
+	stream_start(reader);
+	poll_wait(file, &stream_wait, wait);
+
+	if (smp_load_acquire(&stream_head) != READ_ONCE(reader->cursor))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static struct msi_ec_field_value *fields_copy_in(struct msi_ec_fields *req,
+						void __user *argp)
+{
+	struct msi_ec_field_value *values;
+
+	if (copy_from_user(req, argp, sizeof(*req)))
+		return ERR_PTR(-EFAULT);
+
+	if (req->flags || !req->count || req->count > MSI_EC_IOC_FIELDS_MAX)
+		return ERR_PTR(-EINVAL);
+
+	values = kmalloc_array(req->count, sizeof(*values), GFP_KERNEL);
+	if (!values)
+		return ERR_PTR(-ENOMEM);
+
+	if (copy_from_user(values, u64_to_user_ptr(req->values),
+			   req->count * sizeof(*values))) {
+		kfree(values);
+		return ERR_PTR(-EFAULT);
+	}
+
+	for (u32 i = 0; i < req->count; i++) {
+		if (values[i].id >= MSI_EC_FIELD_COUNT) {
+			kfree(values);
+			return ERR_PTR(-EINVAL);
+		}
+		if (!msi_ec_field_supported(&msi_ec_fields[values[i].id])) {
+			kfree(values);
+			return ERR_PTR(-EOPNOTSUPP);
+		}
+	}
+
+	return values;
+}
+
+// all the fields are read under a single ec_lock hold, so they are
+// consistent with each other
+static long fields_get(void __user *argp)
+{
+	struct msi_ec_field_value *values;
+	struct msi_ec_fields req;
+	const struct msi_ec_field *field;
+	long result = 0;
+	u8 raw;
+
+	values = fields_copy_in(&req, argp);
+	if (IS_ERR(values))
+		return PTR_ERR(values);
+
+	// a field that cannot be read or decoded does not fail the others
+	mutex_lock(&ec_lock);
+	for (u32 i = 0; i < req.count; i++) {
+		field = &msi_ec_fields[values[i].id];
+		values[i].value = 0;
+
+		values[i].error = __ec_read_cached(field->address, &raw);
+		if (values[i].error < 0)
+			continue;
+
+		values[i].error = msi_ec_field_decode(field, raw, &values[i].value);
+	}
+	mutex_unlock(&ec_lock);
+
+	if (copy_to_user(u64_to_user_ptr(req.values), values,
+			 req.count * sizeof(*values)))
+		result = -EFAULT;
+
+	kfree(values);
+	return result;
+}
+
+// every value is validated before the first write, the EC is then
+// written in order and count is updated to the entries applied
+static long fields_set(struct file *file, void __user *argp)
+{
+	struct msi_ec_field_value *values;
+	struct msi_ec_fields req;
+	const struct msi_ec_field *field;
+	bool cooler_boost = false;
+	long result = 0;
+	u32 applied = 0;
+	u8 raw;
+
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	values = fields_copy_in(&req, argp);
+	if (IS_ERR(values))
+		return PTR_ERR(values);
+
+	for (u32 i = 0; i < req.count; i++) {
+		field = &msi_ec_fields[values[i].id];
+
+		result = msi_ec_field_encode(field, values[i].value, 0, &raw);
+		if (result < 0)
+			goto report;
+
+		if (values[i].id == MSI_EC_FIELD_COOLER_BOOST)
+			cooler_boost = true;
+	}
+
+	// an explicit cooler boost value overrides a timed boost,
+	// as it does through sysfs
+	if (cooler_boost) {
+		mutex_lock(&cooler_boost_lock);
+		hrtimer_cancel(&cooler_boost_timer);
+		cooler_boost_timed = false;
+	}
+
+	mutex_lock(&ec_lock);
+	for (; applied < req.count; applied++) {
+		field = &msi_ec_fields[values[applied].id];
+		raw = 0;
+
+		if (msi_ec_field_partial(field)) {
+			result = __ec_read_fresh(field->address, &raw);
+			if (result < 0)
+				break;
+		}
+
+		msi_ec_field_encode(field, values[applied].value, raw, &raw);
+
+		result = __ec_write_bits(field->address, raw,
+					 msi_ec_field_partial(field) ?
+						 field->mask : 0xff);
+		if (result < 0)
+			break;
+	}
+	mutex_unlock(&ec_lock);
+
+	if (cooler_boost)
+		mutex_unlock(&cooler_boost_lock);
+
+report:
+	req.count = applied;
+	if (copy_to_user(argp, &req, sizeof(req)))
+		result = -EFAULT;
+
+	kfree(values);
+	return result;
+}
+
+static const u8 schema_units[MSI_EC_FIELD_COUNT] = {
+	[MSI_EC_FIELD_WEBCAM]               = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_WEBCAM_BLOCK]         = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_FN_WIN_SWAP]          = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_COOLER_BOOST]         = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_SHIFT_MODE]           = MSI_EC_UNIT_ENUM,
+	[MSI_EC_FIELD_SUPER_BATTERY]        = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_FAN_MODE]             = MSI_EC_UNIT_ENUM,
+	[MSI_EC_FIELD_CHARGE_END]           = MSI_EC_UNIT_PERCENT,
+	[MSI_EC_FIELD_CPU_TEMP]             = MSI_EC_UNIT_CELSIUS,
+	[MSI_EC_FIELD_CPU_FAN_SPEED]        = MSI_EC_UNIT_PERCENT,
+	[MSI_EC_FIELD_CPU_BASIC_FAN_SPEED]  = MSI_EC_UNIT_PERCENT,
+	[MSI_EC_FIELD_GPU_TEMP]             = MSI_EC_UNIT_CELSIUS,
+	[MSI_EC_FIELD_GPU_FAN_SPEED]        = MSI_EC_UNIT_PERCENT,
+	[MSI_EC_FIELD_MICMUTE_LED]          = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_MUTE_LED]             = MSI_EC_UNIT_BOOL,
+	[MSI_EC_FIELD_KBD_BACKLIGHT]        = MSI_EC_UNIT_LEVEL,
+};
+
+#define SCHEMA_COLUMN(_field, _member, _valid_bit)			\
+	{								\
+		.field = _field,					\
+		.offset = offsetof(struct msi_ec_sample, _member),	\
+		.size = sizeof_field(struct msi_ec_sample, _member),	\
+		.valid_bit = _valid_bit,				\
+	}
+
+// layout of struct msi_ec_sample, columns of unsupported fields hold 0
+static const struct msi_ec_schema_column schema_columns[] = {
+	SCHEMA_COLUMN(MSI_EC_FIELD_CPU_TEMP,
+		      value[MSI_EC_SENSOR_CPU_TEMP], MSI_EC_SENSOR_CPU_TEMP),
+	SCHEMA_COLUMN(MSI_EC_FIELD_CPU_FAN_SPEED,
+		      value[MSI_EC_SENSOR_CPU_FAN], MSI_EC_SENSOR_CPU_FAN),
+	SCHEMA_COLUMN(MSI_EC_FIELD_GPU_TEMP,
+		      value[MSI_EC_SENSOR_GPU_TEMP], MSI_EC_SENSOR_GPU_TEMP),
+	SCHEMA_COLUMN(MSI_EC_FIELD_GPU_FAN_SPEED,
+		      value[MSI_EC_SENSOR_GPU_FAN], MSI_EC_SENSOR_GPU_FAN),
+	SCHEMA_COLUMN(MSI_EC_FIELD_SHIFT_MODE,
+		      shift_mode, MSI_EC_SCHEMA_NO_VALID_BIT),
+	SCHEMA_COLUMN(MSI_EC_FIELD_FAN_MODE,
+		      fan_mode, MSI_EC_SCHEMA_NO_VALID_BIT),
+	SCHEMA_COLUMN(MSI_EC_FIELD_COOLER_BOOST,
+		      cooler_boost, MSI_EC_SCHEMA_NO_VALID_BIT),
+};
+
+static void schema_field_fill(enum msi_ec_field_id id,
+			      struct msi_ec_schema_field *desc)
+{
+	const struct msi_ec_field *field = &msi_ec_fields[id];
+	struct msi_ec_schema_label *label;
+	u8 raw;
+
+	memset(desc, 0, sizeof(*desc));
+	desc->id = id;
+	desc->unit = schema_units[id];
+	desc->scale = 1;
+	strscpy(desc->name, field->name, sizeof(desc->name));
+
+	if (!msi_ec_field_supported(field))
+		return;
+
+	desc->flags = MSI_EC_SCHEMA_FIELD_SUPPORTED;
+	if (msi_ec_field_encode(field, 0, 0, &raw) != -EACCES)
+		desc->flags |= MSI_EC_SCHEMA_FIELD_WRITABLE;
+
+	switch (desc->unit) {
+	case MSI_EC_UNIT_BOOL:
+		desc->max = 1;
+		break;
+	case MSI_EC_UNIT_ENUM:
+		for (int i = 0; i < MSI_EC_SCHEMA_LABELS_MAX && field->modes &&
+				field->modes[i].name; i++) {
+			label = &desc->labels[desc->label_count++];
+			label->value = field->modes[i].value;
+			strscpy(label->name, field->modes[i].name,
+				sizeof(label->name));
+
+			if (i == 0 || label->value < desc->min)
+				desc->min = label->value;
+			desc->max = max_t(u32, desc->max, label->value);
+		}
+		break;
+	case MSI_EC_UNIT_CELSIUS:
+		desc->max = U8_MAX;
+		break;
+	case MSI_EC_UNIT_PERCENT:
+		desc->max = 100;
+		if (field->kind == MSI_EC_FIELD_KIND_CHARGE) {
+			desc->min = conf.charge_control.range_min -
+				    conf.charge_control.offset_end;
+			desc->max = conf.charge_control.range_max -
+				    conf.charge_control.offset_end;
+		}
+		break;
+	case MSI_EC_UNIT_LEVEL:
+		desc->max = 3;
+		break;
+	}
+}
+
+// fetched once by binary clients, which then need no per-model logic
+static long schema_get(void __user *argp)
+{
+	struct msi_ec_schema_field __user *fields;
+	struct msi_ec_schema_field desc;
+	struct msi_ec_schema schema;
+	u32 count;
+
+	if (copy_from_user(&schema, argp, sizeof(schema)))
+		return -EFAULT;
+
+	fields = u64_to_user_ptr(schema.fields);
+	count = min_t(u32, schema.field_count, MSI_EC_FIELD_COUNT);
+	for (u32 id = 0; id < count; id++) {
+		schema_field_fill(id, &desc);
+		if (copy_to_user(&fields[id], &desc, sizeof(desc)))
+			return -EFAULT;
+	}
+
+	count = min_t(u32, schema.column_count, ARRAY_SIZE(schema_columns));
+	if (count && copy_to_user(u64_to_user_ptr(schema.columns),
+				  schema_columns,
+				  count * sizeof(schema_columns[0])))
+		return -EFAULT;
+
+	schema.version = MSI_EC_IOC_VERSION;
+	schema.sample_size = sizeof(struct msi_ec_sample);
+	schema.field_count = MSI_EC_FIELD_COUNT;
+	schema.column_count = ARRAY_SIZE(schema_columns);
+
+	if (copy_to_user(argp, &schema, sizeof(schema)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long stream_ioctl(struct file *file, unsigned int cmd,
+			 unsigned long arg)
+{
+	struct msi_ec_stream_reader *reader = file->private_data;
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case MSI_EC_IOC_GET_VERSION:
+		return put_user(MSI_EC_IOC_VERSION, (__u32 __user *)argp);
+
+	case MSI_EC_IOC_GET_FIELDS:
+		return fields_get(argp);
+
+	case MSI_EC_IOC_SET_FIELDS:
+		return fields_set(file, argp);
+
+	case MSI_EC_IOC_GET_SCHEMA:
+		return schema_get(argp);
+
+	case MSI_EC_IOC_STREAM_STATS: {
+		struct msi_ec_stream_stats stats;
+
+		mutex_lock(&reader->lock);
+		stats.head = smp_load_acquire(&stream_head);
+		stats.cursor = reader->cursor;
+		stats.overruns = reader->overruns;
+		mutex_unlock(&reader->lock);
+
+		if (copy_to_user(argp, &stats, sizeof(stats)))
+			return -EFAULT;
+
+		return 0;
+	}
+	}
+
+	return -ENOTTY;
+}
+
+static const struct file_operations msi_ec_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = stream_open,
+	.release = stream_release,
+	.read = stream_read,
+	.poll = stream_poll,
+	.unlocked_ioctl = stream_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice msi_ec_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = MSI_EC_DRIVER_NAME,
+	.fops = &msi_ec_stream_fops,
+	.mode = 0644, // writers may set fields
+};
+
+static bool msi_ec_miscdev_registered;
+
+// ============================================================ //
+// BPF kfuncs
+// ============================================================ //
+
+#if IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES)
+
+#ifndef __bpf_kfunc
+#define __bpf_kfunc __used noinline
+#endif
+
+// returns the latest record of the background sampler
+static int msi_ec_latest_sample(struct msi_ec_sample *sample)
+{
+	for (int retries = 0; retries < 3; retries++) {
+		u64 head = smp_load_acquire(&stream_head);
+
+		if (!head)
+			return -ENODATA;
+
+		if (stream_fetch(head - 1, sample))
+			return 0;
+	}
+
+	return -EAGAIN;
+}
+
+#ifdef KF_ITER_NEW
+
+// open-coded iterator over the cached EC fields
+struct bpf_iter_msi_ec_field {
+	__u64 __opaque[2];
+} __aligned(8);
+
+struct bpf_iter_msi_ec_field_kern {
+	int next;
+	struct msi_ec_field_value current;
+} __aligned(8);
+
+#endif // KF_ITER_NEW
+
+__diag_push();
+__diag_ignore_all("-Wmissing-prototypes",
+		  "Global functions as their definitions will be in BTF");
+
+__bpf_kfunc int bpf_msi_ec_snapshot(struct msi_ec_sample *sample,
+				    u32 sample__sz)
+{
+	if (sample__sz != sizeof(*sample))
+		return -EINVAL;
+
+	return msi_ec_latest_sample(sample);
+}
+
+// reads the cached value of field->id; kernels without open-coded
+// iterators walk the fields by id from 0 to MSI_EC_FIELD_COUNT - 1
+__bpf_kfunc int bpf_msi_ec_field_get(struct msi_ec_field_value *field,
+				     u32 field__sz)
+{
+	if (field__sz != sizeof(*field) || field->id >= MSI_EC_FIELD_COUNT)
+		return -EINVAL;
+
+	// unsupported fields and those never read from the EC
+	if (!msi_ec_field_peek(&msi_ec_fields[field->id], &field->value))
+		return -ENODATA;
+
+	return 0;
+}
+
+#ifdef KF_ITER_NEW
+
+__bpf_kfunc int bpf_iter_msi_ec_field_new(struct bpf_iter_msi_ec_field *it)
+{
+	struct bpf_iter_msi_ec_field_kern *kit = (void *)it;
+
+	BUILD_BUG_ON(sizeof(*kit) > sizeof(*it));
+	BUILD_BUG_ON(__alignof__(*kit) != __alignof__(*it));
+
+	kit->next = 0;
+	return 0;
+}
+
+// skips unsupported fields and those never read from the EC
+__bpf_kfunc struct msi_ec_field_value *
+bpf_iter_msi_ec_field_next(struct bpf_iter_msi_ec_field *it)
+{
+	struct bpf_iter_msi_ec_field_kern *kit = (void *)it;
+
+	while (kit->next < MSI_EC_FIELD_COUNT) {
+		int id = kit->next++;
+
+		if (msi_ec_field_peek(&msi_ec_fields[id], &kit->current.value)) {
+			kit->current.id = id;
+			kit->current.error = 0;
+			return &kit->current;
+		}
+	}
+
+	return NULL;
+}
+
+__bpf_kfunc void bpf_iter_msi_ec_field_destroy(struct bpf_iter_msi_ec_field *it)
+{
+}
+
+#endif // KF_ITER_NEW
+
+__diag_pop();
+
+BTF_SET8_START(msi_ec_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_msi_ec_snapshot)
+BTF_ID_FLAGS(func, bpf_msi_ec_field_get)
+#ifdef KF_ITER_NEW
+BTF_ID_FLAGS(func, bpf_iter_msi_ec_field_new, KF_ITER_NEW)
+BTF_ID_FLAGS(func, bpf_iter_msi_ec_field_next, KF_ITER_NEXT | KF_RET_NULL)
+BTF_ID_FLAGS(func, bpf_iter_msi_ec_field_destroy, KF_ITER_DESTROY)
+#endif
+BTF_SET8_END(msi_ec_kfunc_ids)
+
+static const struct btf_kfunc_id_set msi_ec_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &msi_ec_kfunc_ids,
+};
+
+static void __init msi_ec_bpf_register(void)
+{
+	int result;
+
+	// kfunc sets go away with the module's BTF
+	result = register_btf_kfunc_id_set(BPF_PROG_TYPE_TRACING,
+					   &msi_ec_kfunc_set);
+	if (result < 0)
+		pr_warn("BPF kfuncs are unavailable (%d)\n", result);
+}
+
+#else
+
+static void __init msi_ec_bpf_register(void)
+{
+}
+
+#endif // CONFIG_DEBUG_INFO_BTF_MODULES
+
+// ============================================================ //
+// Perf PMU
+// ============================================================ //
+
+#if IS_ENABLED(CONFIG_PERF_EVENTS)
+
+// Counters are time integrals of the sampled values (value * ns), perf
+// scales them to value * s; dividing by the interval gives the average
+struct msi_ec_pmu_acc {
+	ktime_t last;
+	u8 value[MSI_EC_SENSOR_COUNT];
+	u8 valid;
+	u64 total[MSI_EC_SENSOR_COUNT];
+};
+
+static DEFINE_SEQLOCK(pmu_lock);
+static struct msi_ec_pmu_acc pmu_acc;
+static bool pmu_registered;
+
+static void pmu_accumulate(const struct msi_ec_sensors *sensors)
+{
+	unsigned long flags;
+	u64 elapsed;
+
+	write_seqlock_irqsave(&pmu_lock, flags);
+
+	elapsed = ktime_to_ns(ktime_sub(sensors->timestamp, pmu_acc.last));
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if (pmu_acc.valid & BIT(i))
+			pmu_acc.total[i] += pmu_acc.value[i] * elapsed;
+	}
+
+	pmu_acc.last = sensors->timestamp;
+	memcpy(pmu_acc.value, sensors->value, sizeof(pmu_acc.value));
+	pmu_acc.valid = sensors->valid;
+
+	write_sequnlock_irqrestore(&pmu_lock, flags);
+}
+
+static u64 pmu_counter_read(enum msi_ec_sensor sensor)
+{
+	unsigned int seq;
+	u64 total;
+
+	do {
+		seq = read_seqbegin(&pmu_lock);
+
+		total = pmu_acc.total[sensor];
+		if (pmu_acc.valid & BIT(sensor))
+			total += pmu_acc.value[sensor] *
+				 ktime_to_ns(ktime_sub(ktime_get(), pmu_acc.last));
+	} while (read_seqretry(&pmu_lock, seq));
+
+	return total;
+}
+
+static struct pmu msi_ec_pmu;
+
+static void msi_ec_pmu_event_destroy(struct perf_event *event)
+{
+	msi_ec_sampler_put();
+}
+
+static int msi_ec_pmu_event_init(struct perf_event *event)
+{
+	u64 sensor = event->attr.config;
+
+	if (event->attr.type != msi_ec_pmu.type)
+		return -ENOENT;
+
+	if (sensor >= MSI_EC_SENSOR_COUNT ||
+	    msi_ec_sensor_address(sensor) == MSI_EC_ADDR_UNSUPP)
+		return -EINVAL;
+
+	// values are system-wide and there is no overflow interrupt
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EINVAL;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	msi_ec_sampler_get();
+	event->destroy = msi_ec_pmu_event_destroy;
+
+	return 0;
+}
+
+static void msi_ec_pmu_event_update(struct perf_event *event)
+{
+	u64 prev, now;
+
+	do {
+		prev = local64_read(&event->hw.prev_count);
+		now = pmu_counter_read(event->attr.config);
+	} while (local64_cmpxchg(&event->hw.prev_count, prev, now) != prev);
+
+	local64_add(now - prev, &event->count);
+}
+
+static void msi_ec_pmu_event_start(struct perf_event *event, int flags)
+{
+	local64_set(&event->hw.prev_count, pmu_counter_read(event->attr.config));
+	event->hw.state = 0;
+}
+
+static void msi_ec_pmu_event_stop(struct perf_event *event, int flags)
+{
+	if (!(event->hw.state & PERF_HES_STOPPED)) {
+		msi_ec_pmu_event_update(event);
+		event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	}
+}
+
+static int msi_ec_pmu_event_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+
+	if (flags & PERF_EF_START)
+		msi_ec_pmu_event_start(event, flags);
+
+	return 0;
+}
+
+static void msi_ec_pmu_event_del(struct perf_event *event, int flags)
+{
+	msi_ec_pmu_event_stop(event, PERF_EF_UPDATE);
+}
+
+static void msi_ec_pmu_event_read(struct perf_event *event)
+{
+	msi_ec_pmu_event_update(event);
+}
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *msi_ec_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL
+};
+
+static const struct attribute_group msi_ec_pmu_format_group = {
+	.name = "format",
+	.attrs = msi_ec_pmu_format_attrs,
+};
+
+PMU_EVENT_ATTR_STRING(cpu_temp, msi_ec_pmu_cpu_temp, "event=0x00");
+PMU_EVENT_ATTR_STRING(cpu_temp.unit, msi_ec_pmu_cpu_temp_unit, "C*s");
+PMU_EVENT_ATTR_STRING(cpu_temp.scale, msi_ec_pmu_cpu_temp_scale, "1e-9");
+PMU_EVENT_ATTR_STRING(cpu_fan, msi_ec_pmu_cpu_fan, "event=0x01");
+PMU_EVENT_ATTR_STRING(cpu_fan.unit, msi_ec_pmu_cpu_fan_unit, "%*s");
+PMU_EVENT_ATTR_STRING(cpu_fan.scale, msi_ec_pmu_cpu_fan_scale, "1e-9");
+PMU_EVENT_ATTR_STRING(gpu_temp, msi_ec_pmu_gpu_temp, "event=0x02");
+PMU_EVENT_ATTR_STRING(gpu_temp.unit, msi_ec_pmu_gpu_temp_unit, "C*s");
+PMU_EVENT_ATTR_STRING(gpu_temp.scale, msi_ec_pmu_gpu_temp_scale, "1e-9");
+PMU_EVENT_ATTR_STRING(gpu_fan, msi_ec_pmu_gpu_fan, "event=0x03");
+PMU_EVENT_ATTR_STRING(gpu_fan.unit, msi_ec_pmu_gpu_fan_unit, "%*s");
+PMU_EVENT_ATTR_STRING(gpu_fan.scale, msi_ec_pmu_gpu_fan_scale, "1e-9");
+
+static struct attribute *msi_ec_pmu_event_attrs[] = {
+	&msi_ec_pmu_cpu_temp.attr.attr,
+	&msi_ec_pmu_cpu_temp_unit.attr.attr,
+	&msi_ec_pmu_cpu_temp_scale.attr.attr,
+	&msi_ec_pmu_cpu_fan.attr.attr,
+	&msi_ec_pmu_cpu_fan_unit.attr.attr,
+	&msi_ec_pmu_cpu_fan_scale.attr.attr,
+	&msi_ec_pmu_gpu_temp.attr.attr,
+	&msi_ec_pmu_gpu_temp_unit.attr.attr,
+	&msi_ec_pmu_gpu_temp_scale.attr.attr,
+	&msi_ec_pmu_gpu_fan.attr.attr,
+	&msi_ec_pmu_gpu_fan_unit.attr.attr,
+	&msi_ec_pmu_gpu_fan_scale.attr.attr,
+	NULL
+};
+
+static const struct attribute_group msi_ec_pmu_events_group = {
+	.name = "events",
+	.attrs = msi_ec_pmu_event_attrs,
+};
+
+// system-wide counters, perf opens them on a single cpu
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf, cpumask_of(0));
+}
+
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *msi_ec_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL
+};
+
+static const struct attribute_group msi_ec_pmu_cpumask_group = {
+	.attrs = msi_ec_pmu_cpumask_attrs,
+};
+
+static const struct attribute_group *msi_ec_pmu_attr_groups[] = {
+	&msi_ec_pmu_format_group,
+	&msi_ec_pmu_events_group,
+	&msi_ec_pmu_cpumask_group,
+	NULL
+};
+
+static struct pmu msi_ec_pmu = {
+	.module = THIS_MODULE,
+	.task_ctx_nr = perf_invalid_context,
+	.capabilities = PERF_PMU_CAP_NO_INTERRUPT | PERF_PMU_CAP_NO_EXCLUDE,
+	.attr_groups = msi_ec_pmu_attr_groups,
+	.event_init = msi_ec_pmu_event_init,
+	.add = msi_ec_pmu_event_add,
+	.del = msi_ec_pmu_event_del,
+	.start = msi_ec_pmu_event_start,
+	.stop = msi_ec_pmu_event_stop,
+	.read = msi_ec_pmu_event_read,
+};
+
+static void __init msi_ec_pmu_register(void)
+{
+	int result;
+
+	result = perf_pmu_register(&msi_ec_pmu, "msi_ec", -1);
+	if (result < 0) {
+		pr_warn("perf PMU is unavailable (%d)\n", result);
+		return;
+	}
+
+	pmu_registered = true;
+}
+
+static void msi_ec_pmu_unregister(void)
+{
+	if (pmu_registered)
+		perf_pmu_unregister(&msi_ec_pmu);
+}
+
+#else
+
+static void pmu_accumulate(const struct msi_ec_sensors *sensors)
+{
+}
+
+static void __init msi_ec_pmu_register(void)
+{
+}
+
+static void msi_ec_pmu_unregister(void)
+{
+}
+
+#endif // CONFIG_PERF_EVENTS
+
+// ============================================================ //
+// Background sampler
+// ============================================================ //
+
+static bool sampler_running;
+static atomic_t sampler_users = ATOMIC_INIT(0);
+static bool sampler_idle = true; // sampler only, no pass is scheduled
+
+static void msi_ec_sampler_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(msi_ec_sampler, msi_ec_sampler_fn);
+
+// Stream readers, netlink subscribers, perf events, open hotkey input
+// devices and the statistics readers keep the sampler running; without
+// them the EC is left alone
+static void msi_ec_sampler_get(void)
+{
+	if (atomic_inc_return(&sampler_users) == 1 && READ_ONCE(sampler_running))
+		mod_delayed_work(system_wq, &msi_ec_sampler, 0);
+}
+
+// the sampler stops after its current pass
+static void msi_ec_sampler_put(void)
+{
+	atomic_dec(&sampler_users);
+}
+
+static int sample_interval_set(const char *val, const struct kernel_param *kp)
+{
+	int result;
+
+	result = param_set_uint(val, kp);
+	if (result < 0)
+		return result;
+
+	// restart the sampler with the new interval
+	if (READ_ONCE(sampler_running) && atomic_read(&sampler_users))
+		mod_delayed_work(system_wq, &msi_ec_sampler, 0);
+
+	return 0;
+}
+
+static const struct kernel_param_ops sample_interval_ops = {
+	.set = sample_interval_set,
+	.get = param_get_uint,
+};
+
+static unsigned int sample_interval_ms = 1000;
+module_param_cb(sample_interval_ms, &sample_interval_ops, &sample_interval_ms, 0644);
+MODULE_PARM_DESC(sample_interval_ms,
+		 "Interval of the background EC sampler in ms, while it has consumers (0 disables it)");
+
+// Registers of the supported fields, packed into whole words so that
+// successive snapshots are compared a word at a time
+#define MSI_EC_SNAPSHOT_WORDS \
+	DIV_ROUND_UP(MSI_EC_FIELD_COUNT, sizeof(unsigned long))
+
+union msi_ec_snapshot {
+	unsigned long word[MSI_EC_SNAPSHOT_WORDS];
+	u8 byte[MSI_EC_SNAPSHOT_WORDS * sizeof(unsigned long)];
+};
+
+static u8 snapshot_address[MSI_EC_FIELD_COUNT];
+static int snapshot_count;
+static int snapshot_slot[MSI_EC_FIELD_COUNT]; // -1 for unsupported fields
+static union msi_ec_snapshot snapshot_prev; // sampler only
+static bool snapshot_primed;
+
+static void __init snapshot_init(void)
+{
+	for (int id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+		const struct msi_ec_field *field = &msi_ec_fields[id];
+		int slot;
+
+		snapshot_slot[id] = -1;
+		if (!msi_ec_field_supported(field))
+			continue;
+
+		for (slot = 0; slot < snapshot_count; slot++) {
+			if (snapshot_address[slot] == field->address)
+				break;
+		}
+
+		if (slot == snapshot_count)
+			snapshot_address[snapshot_count++] = field->address;
+
+		snapshot_slot[id] = slot;
+	}
+}
+
+// must be called with ec_lock held; registers that cannot be read keep
+// their previous value, refreshing them feeds the time-in-state accounting
+static void __snapshot_read(union msi_ec_snapshot *snapshot)
+{
+	*snapshot = snapshot_prev;
+
+	for (int slot = 0; slot < snapshot_count; slot++)
+		__ec_read_fresh(snapshot_address[slot], &snapshot->byte[slot]);
+}
+
+static bool snapshot_field(const union msi_ec_snapshot *snapshot,
+			   enum msi_ec_field_id id, u8 *raw)
+{
+	if (snapshot_slot[id] < 0)
+		return false;
+
+	*raw = snapshot->byte[snapshot_slot[id]];
+	return true;
+}
+
+static void msi_ec_genl_field_event(enum msi_ec_field_id id, u32 old_value,
+				    u32 new_value);
+static void __hotkeys_check(const union msi_ec_snapshot *snapshot,
+			    bool report);
+
+// reports the fields whose bits changed between two snapshots
+static void snapshot_diff(const union msi_ec_snapshot *prev,
+			  const union msi_ec_snapshot *cur)
+{
+	union msi_ec_snapshot diff;
+	bool changed = false;
+
+	for (int i = 0; i < MSI_EC_SNAPSHOT_WORDS; i++) {
+		diff.word[i] = prev->word[i] ^ cur->word[i];
+		changed |= diff.word[i] != 0;
+	}
+
+	if (!changed)
+		return;
+
+	for (int id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+		const struct msi_ec_field *field = &msi_ec_fields[id];
+		int slot = snapshot_slot[id];
+		u32 old_value, new_value;
+
+		if (slot < 0 || !(diff.byte[slot] & field->mask))
+			continue;
+
+		if (msi_ec_field_decode(field, prev->byte[slot], &old_value) < 0 ||
+		    msi_ec_field_decode(field, cur->byte[slot], &new_value) < 0 ||
+		    old_value == new_value)
+			continue;
+
+		msi_ec_genl_field_event(id, old_value, new_value);
+	}
+}
+
+// Register volatility, observed on the snapshots for volatility_observe_s
+// seconds, then used to set the cache TTL of each register
+static unsigned int volatility_observe_s;
+module_param(volatility_observe_s, uint, 0444);
+MODULE_PARM_DESC(volatility_observe_s,
+		 "Seconds of register observation before tuning cache TTLs (0 disables it, see debugfs msi-ec/volatility)");
+
+enum msi_ec_volatility {
+	MSI_EC_VOLATILITY_UNKNOWN,     // still observing
+	MSI_EC_VOLATILITY_STATIC,      // never changed
+	MSI_EC_VOLATILITY_WRITE_OWNED, // only changed by writes of this driver
+	MSI_EC_VOLATILITY_SLOW,        // changed less than once a minute
+	MSI_EC_VOLATILITY_FAST,
+	MSI_EC_VOLATILITY_HOTKEY,      // also changed by the firmware on hotkeys
+};
+
+static const char *const volatility_names[] = {
+	[MSI_EC_VOLATILITY_UNKNOWN]     = "unknown",
+	[MSI_EC_VOLATILITY_STATIC]      = "static",
+	[MSI_EC_VOLATILITY_WRITE_OWNED] = "write-owned",
+	[MSI_EC_VOLATILITY_SLOW]        = "slow",
+	[MSI_EC_VOLATILITY_FAST]        = "fast",
+	[MSI_EC_VOLATILITY_HOTKEY]      = "hotkey",
+};
+
+// An observation window only shows what happened during it, so no class
+// gets an unbounded lifetime
+static const unsigned int volatility_ttl_ms[] = {
+	[MSI_EC_VOLATILITY_UNKNOWN]     = EC_CACHE_TTL_DEFAULT,
+	[MSI_EC_VOLATILITY_STATIC]      = 60 * 1000,
+	[MSI_EC_VOLATILITY_WRITE_OWNED] = 60 * 1000,
+	[MSI_EC_VOLATILITY_SLOW]        = 10 * 1000,
+	[MSI_EC_VOLATILITY_FAST]        = EC_CACHE_TTL_DEFAULT,
+	[MSI_EC_VOLATILITY_HOTKEY]      = EC_CACHE_TTL_DEFAULT,
+};
+
+// Fn hotkeys change these registers at any time, a window without key
+// presses says nothing about them
+static bool volatility_hotkey_register(u8 address)
+{
+	const int registers[] = {
+		conf.webcam.address,
+		conf.cooler_boost.address,
+		conf.shift_mode.address,
+		conf.fan_mode.address,
+		conf.kbd_bl.bl_state_address,
+	};
+
+	for (int i = 0; i < ARRAY_SIZE(registers); i++) {
+		if (registers[i] == address)
+			return true;
+	}
+
+	return false;
+}
+
+// per snapshot slot, guarded by ec_lock
+static struct {
+	ktime_t started;
+	bool done;
+	u32 changes[MSI_EC_FIELD_COUNT];  // by anyone
+	u32 external[MSI_EC_FIELD_COUNT]; // not explained by a driver write
+	u32 writes[MSI_EC_FIELD_COUNT];   // ec_cache writes at the last pass
+	enum msi_ec_volatility class[MSI_EC_FIELD_COUNT];
+} volatility;
+
+// must be called with ec_lock held
+static void __volatility_classify(s64 elapsed_s)
+{
+	for (int slot = 0; slot < snapshot_count; slot++) {
+		struct ec_cache_entry *entry = &ec_cache[snapshot_address[slot]];
+		enum msi_ec_volatility class;
+
+		if (volatility_hotkey_register(snapshot_address[slot]))
+			class = MSI_EC_VOLATILITY_HOTKEY;
+		else if (!volatility.changes[slot])
+			class = MSI_EC_VOLATILITY_STATIC;
+		else if (!volatility.external[slot])
+			class = MSI_EC_VOLATILITY_WRITE_OWNED;
+		else if (volatility.external[slot] * 60 < elapsed_s)
+			class = MSI_EC_VOLATILITY_SLOW;
+		else
+			class = MSI_EC_VOLATILITY_FAST;
+
+		volatility.class[slot] = class;
+
+		// registers the configuration knows to be write-owned keep
+		// their TTL
+		if (entry->ttl_ms != EC_CACHE_TTL_FOREVER)
+			entry->ttl_ms = volatility_ttl_ms[class];
+	}
+
+	volatility.done = true;
+	msi_ec_sampler_put();
+	pr_info("register volatility classified, cache TTLs updated\n");
+}
+
+// must be called with ec_lock held, before snapshot_prev is replaced
+static void __volatility_observe(const union msi_ec_snapshot *snapshot)
+{
+	s64 elapsed_s;
+
+	if (!volatility_observe_s || volatility.done)
+		return;
+
+	if (!snapshot_primed) {
+		volatility.started = ktime_get();
+	} else {
+		for (int slot = 0; slot < snapshot_count; slot++) {
+			if (snapshot->byte[slot] == snapshot_prev.byte[slot])
+				continue;
+
+			volatility.changes[slot]++;
+			if (ec_cache[snapshot_address[slot]].writes ==
+			    volatility.writes[slot])
+				volatility.external[slot]++;
+		}
+	}
+
+	for (int slot = 0; slot < snapshot_count; slot++)
+		volatility.writes[slot] = ec_cache[snapshot_address[slot]].writes;
+
+	elapsed_s = ktime_to_ms(ktime_sub(ktime_get(), volatility.started)) / 1000;
+	if (elapsed_s >= volatility_observe_s)
+		__volatility_classify(elapsed_s);
+}
+
+static int volatility_show(struct seq_file *m, void *v)
+{
+	mutex_lock(&ec_lock);
+
+	seq_printf(m, "observation: %s\n",
+		   !volatility_observe_s ? "disabled" :
+		   volatility.done ? "done" : "running");
+	seq_puts(m, "addr  class        changes  external  ttl_ms  fields\n");
+
+	for (int slot = 0; slot < snapshot_count; slot++) {
+		u8 address = snapshot_address[slot];
+		unsigned int ttl_ms = ec_cache[address].ttl_ms;
+
+		seq_printf(m, "0x%02x  %-11s  %7u  %8u  ", address,
+			   volatility_names[volatility.class[slot]],
+			   volatility.changes[slot], volatility.external[slot]);
+
+		if (ttl_ms == EC_CACHE_TTL_FOREVER)
+			seq_puts(m, "   inf ");
+		else
+			seq_printf(m, "%6u ", ttl_ms ?: cache_ttl_ms);
+
+		for (int id = 0; id < MSI_EC_FIELD_COUNT; id++) {
+			if (snapshot_slot[id] == slot)
+				seq_printf(m, " %s", msi_ec_fields[id].name);
+		}
+		seq_putc(m, '\n');
+	}
+
+	mutex_unlock(&ec_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(volatility);
+
+static void msi_ec_genl_telemetry(const struct msi_ec_sample *sample,
+				  unsigned int sample_interval);
+static void msi_ec_temp_alarm_check(const struct msi_ec_sample *sample);
+
+static const enum msi_ec_field_id sensor_fields[MSI_EC_SENSOR_COUNT] = {
+	[MSI_EC_SENSOR_CPU_TEMP] = MSI_EC_FIELD_CPU_TEMP,
+	[MSI_EC_SENSOR_CPU_FAN]  = MSI_EC_FIELD_CPU_FAN_SPEED,
+	[MSI_EC_SENSOR_GPU_TEMP] = MSI_EC_FIELD_GPU_TEMP,
+	[MSI_EC_SENSOR_GPU_FAN]  = MSI_EC_FIELD_GPU_FAN_SPEED,
+};
+
+static void msi_ec_sampler_fn(struct work_struct *work)
+{
+	unsigned int interval = READ_ONCE(sample_interval_ms);
+	union msi_ec_snapshot snapshot;
+	struct msi_ec_sensors sensors = { 0 };
+	struct msi_ec_sample sample = { 0 };
+	u8 raw;
+
+	if (!interval || !atomic_read(&sampler_users)) {
+		sampler_idle = true;
+		return;
+	}
+
+	// nothing is accounted for the time the sampler was idle
+	if (sampler_idle) {
+		sampler_idle = false;
+		snapshot_primed = false;
+		histograms_resume();
+	}
+
+	mutex_lock(&ec_lock);
+	__snapshot_read(&snapshot);
+	__volatility_observe(&snapshot);
+	__hotkeys_check(&snapshot, snapshot_primed);
+	mutex_unlock(&ec_lock);
+
+	sensors.timestamp = ktime_get();
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if (snapshot_field(&snapshot, sensor_fields[i], &raw))
+			sensor_store(&sensors, i, raw);
+	}
+
+	if (snapshot_primed)
+		snapshot_diff(&snapshot_prev, &snapshot);
+	snapshot_prev = snapshot;
+	snapshot_primed = true;
+
+	histograms_update(&sensors);
+	history_update(&sensors);
+	pmu_accumulate(&sensors);
+
+	sample.timestamp_ns = ktime_to_ns(sensors.timestamp);
+	memcpy(sample.value, sensors.value, sizeof(sample.value));
+	sample.valid = sensors.valid;
+	if (snapshot_field(&snapshot, MSI_EC_FIELD_SHIFT_MODE, &raw))
+		sample.shift_mode = raw;
+	if (snapshot_field(&snapshot, MSI_EC_FIELD_FAN_MODE, &raw))
+		sample.fan_mode = raw;
+	if (snapshot_field(&snapshot, MSI_EC_FIELD_COOLER_BOOST, &raw))
+		sample.cooler_boost = check_bit(raw, conf.cooler_boost.bit);
+	stream_push(&sample);
+	msi_ec_genl_telemetry(&sample, interval);
+	msi_ec_temp_alarm_check(&sample);
+
+	if (READ_ONCE(sampler_running) && atomic_read(&sampler_users))
+		schedule_delayed_work(&msi_ec_sampler, msecs_to_jiffies(interval));
+	else
+		sampler_idle = true;
+}
+
+static void __init msi_ec_sampler_start(void)
+{
+	histograms.reset = ktime_get();
+	history_init();
+	snapshot_init();
+	WRITE_ONCE(sampler_running, true);
+
+	// released once the registers are classified
+	if (volatility_observe_s)
+		msi_ec_sampler_get();
+}
+
+static void msi_ec_sampler_stop(void)
+{
+	WRITE_ONCE(sampler_running, false);
+	cancel_delayed_work_sync(&msi_ec_sampler);
+}
+
+// ============================================================ //
+// Generic netlink
+// ============================================================ //
+
+// telemetry interval requested by a netlink socket
+struct msi_ec_genl_subscriber {
+	struct list_head list;
+	u32 portid;
+	u32 interval_ms;
+};
+
+static DEFINE_SPINLOCK(genl_subscribers_lock);
+static LIST_HEAD(genl_subscribers);
+static bool genl_registered;
+static u64 genl_telemetry_last; // ns, sampler only
+
+static const struct nla_policy msi_ec_genl_policy[MSI_EC_ATTR_MAX + 1] = {
+	[MSI_EC_ATTR_INTERVAL_MS] = { .type = NLA_U32 },
+};
+
+static const struct genl_multicast_group msi_ec_genl_mcgrps[] = {
+	{ .name = MSI_EC_GENL_MCGRP },
+};
+
+static int msi_ec_genl_set_rate(struct sk_buff *skb, struct genl_info *info);
+
+static const struct genl_small_ops msi_ec_genl_ops[] = {
+	{
+		.cmd = MSI_EC_CMD_SET_RATE,
+		.doit = msi_ec_genl_set_rate,
+		.flags = GENL_ADMIN_PERM,
+	},
+};
+
+static struct genl_family msi_ec_genl_family __ro_after_init = {
+	.name = MSI_EC_GENL_NAME,
+	.version = MSI_EC_GENL_VERSION,
+	.maxattr = MSI_EC_ATTR_MAX,
+	.policy = msi_ec_genl_policy,
+	.module = THIS_MODULE,
+	.small_ops = msi_ec_genl_ops,
+	.n_small_ops = ARRAY_SIZE(msi_ec_genl_ops),
+	.resv_start_op = MSI_EC_CMD_SET_RATE,
+	.mcgrps = msi_ec_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(msi_ec_genl_mcgrps),
+};
+
+// the fastest requested rate, bounded by the sampler; 0 means every pass
+static u32 genl_telemetry_interval(void)
+{
+	struct msi_ec_genl_subscriber *subscriber;
+	unsigned long flags;
+	u32 interval = 0;
+
+	spin_lock_irqsave(&genl_subscribers_lock, flags);
+	list_for_each_entry(subscriber, &genl_subscribers, list) {
+		if (!interval || subscriber->interval_ms < interval)
+			interval = subscriber->interval_ms;
+	}
+	spin_unlock_irqrestore(&genl_subscribers_lock, flags);
+
+	return interval;
+}
+
+static void genl_subscriber_remove(u32 portid)
+{
+	struct msi_ec_genl_subscriber *subscriber, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&genl_subscribers_lock, flags);
+	list_for_each_entry_safe(subscriber, tmp, &genl_subscribers, list) {
+		if (subscriber->portid == portid) {
+			list_del(&subscriber->list);
+			kfree(subscriber);
+			msi_ec_sampler_put();
+		}
+	}
+	spin_unlock_irqrestore(&genl_subscribers_lock, flags);
+}
+
+static int msi_ec_genl_set_rate(struct sk_buff *skb, struct genl_info *info)
+{
+	struct msi_ec_genl_subscriber *subscriber, *new;
+	unsigned long flags;
+	struct sk_buff *msg;
+	void *hdr;
+	u32 interval;
+
+	if (!info->attrs[MSI_EC_ATTR_INTERVAL_MS])
+		return -EINVAL;
+
+	interval = nla_get_u32(info->attrs[MSI_EC_ATTR_INTERVAL_MS]);
+
+	genl_subscriber_remove(info->snd_portid);
+
+	if (interval) {
+		new = kzalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+
+		new->portid = info->snd_portid;
+		new->interval_ms = interval;
+
+		spin_lock_irqsave(&genl_subscribers_lock, flags);
+		list_add(&new->list, &genl_subscribers);
+		spin_unlock_irqrestore(&genl_subscribers_lock, flags);
+
+		// subscribers keep the sampler running
+		msi_ec_sampler_get();
+	}
+
+	// reply with the effective interval
+	interval = max(genl_telemetry_interval(), READ_ONCE(sample_interval_ms));
+
+	msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	hdr = genlmsg_put_reply(msg, info, &msi_ec_genl_family, 0,
+				MSI_EC_CMD_SET_RATE);
+	if (!hdr || nla_put_u32(msg, MSI_EC_ATTR_INTERVAL_MS, interval)) {
+		nlmsg_free(msg);
+		return -EMSGSIZE;
+	}
+
+	genlmsg_end(msg, hdr);
+	return genlmsg_reply(msg, info);
+}
+
+static int msi_ec_genl_notify(struct notifier_block *nb, unsigned long state,
+			      void *ptr)
+{
+	struct netlink_notify *notify = ptr;
+
+	if (state == NETLINK_URELEASE && notify->protocol == NETLINK_GENERIC)
+		genl_subscriber_remove(notify->portid);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block msi_ec_genl_notifier = {
+	.notifier_call = msi_ec_genl_notify,
+};
+
+static int genl_put_sensor(struct sk_buff *msg, enum msi_ec_sensor sensor,
+			   u8 value)
+{
+	struct nlattr *nest;
+
+	nest = nla_nest_start(msg, MSI_EC_ATTR_SENSOR);
+	if (!nest)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(msg, MSI_EC_ATTR_SENSOR_ID, sensor) ||
+	    nla_put_u32(msg, MSI_EC_ATTR_SENSOR_VALUE, value)) {
+		nla_nest_cancel(msg, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(msg, nest);
+	return 0;
+}
+
+static void genl_multicast(struct sk_buff *msg, void *hdr)
+{
+	genlmsg_end(msg, hdr);
+	genlmsg_multicast(&msi_ec_genl_family, msg, 0, 0, GFP_KERNEL);
+}
+
+// starts an event message, NULL when nobody listens
+static struct sk_buff *genl_event_start(enum msi_ec_event event, u32 value,
+					void **hdr)
+{
+	struct sk_buff *msg;
+
+	if (!READ_ONCE(genl_registered) ||
+	    !genl_has_listeners(&msi_ec_genl_family, &init_net, 0))
+		return NULL;
+
+	msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return NULL;
+
+	*hdr = genlmsg_put(msg, 0, 0, &msi_ec_genl_family, 0, MSI_EC_CMD_EVENT);
+	if (!*hdr)
+		goto err;
+
+	if (nla_put_u64_64bit(msg, MSI_EC_ATTR_TIMESTAMP, ktime_get_ns(),
+			      MSI_EC_ATTR_PAD) ||
+	    nla_put_u32(msg, MSI_EC_ATTR_EVENT, event) ||
+	    nla_put_u32(msg, MSI_EC_ATTR_VALUE, value))
+		goto err;
+
+	return msg;
+
+err:
+	nlmsg_free(msg);
+	return NULL;
+}
+
+// with a sample, sensors of the event's value are attached
+static void msi_ec_genl_event(enum msi_ec_event event, u32 value,
+			      const struct msi_ec_sample *sample)
+{
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = genl_event_start(event, value, &hdr);
+	if (!msg)
+		return;
+
+	if (sample && genl_put_sensor(msg, value, sample->value[value]) < 0) {
+		nlmsg_free(msg);
+		return;
+	}
+
+	genl_multicast(msg, hdr);
+}
+
+// LED fields live on their classdev, not on the platform device
+static struct led_classdev *msi_ec_field_led(enum msi_ec_field_id id)
+{
+	switch (id) {
+	case MSI_EC_FIELD_MICMUTE_LED:
+		return &micmute_led_cdev;
+	case MSI_EC_FIELD_MUTE_LED:
+		return &mute_led_cdev;
+	case MSI_EC_FIELD_KBD_BACKLIGHT:
+		return &msiacpi_led_kbdlight;
+	default:
+		return NULL;
+	}
+}
+
+// sampler only, also wakes pollers of the attribute that shows the field
+static void msi_ec_genl_field_event(enum msi_ec_field_id id, u32 old_value,
+				    u32 new_value)
+{
+	const char *name = msi_ec_fields[id].name;
+	const char *attr = strchr(name, '/');
+	struct led_classdev *led = msi_ec_field_led(id);
+	struct sk_buff *msg;
+	void *hdr;
+
+	if (led) {
+		if (!IS_ERR_OR_NULL(led->dev))
+			sysfs_notify(&led->dev->kobj, NULL, "brightness");
+	} else if (id == MSI_EC_FIELD_CHARGE_END) {
+		// the observer already reports it through power_supply_changed()
+	} else if (attr) {
+		char group[8];
+
+		strscpy(group, name, min_t(size_t, sizeof(group), attr - name + 1));
+		sysfs_notify(&msi_platform_device->dev.kobj, group, attr + 1);
+	} else {
+		sysfs_notify(&msi_platform_device->dev.kobj, NULL, name);
+	}
+
+	msg = genl_event_start(MSI_EC_EVENT_FIELD, new_value, &hdr);
+	if (!msg)
+		return;
+
+	if (nla_put_u32(msg, MSI_EC_ATTR_FIELD, id) ||
+	    nla_put_u32(msg, MSI_EC_ATTR_OLD_VALUE, old_value)) {
+		nlmsg_free(msg);
+		return;
+	}
+
+	genl_multicast(msg, hdr);
+}
+
+// all subscribers share the sampler pass that produced the sample
+static void msi_ec_genl_telemetry(const struct msi_ec_sample *sample,
+				  unsigned int sample_interval)
+{
+	u64 interval = (u64)genl_telemetry_interval() * NSEC_PER_MSEC;
+	u64 slack = (u64)sample_interval * NSEC_PER_MSEC / 2;
+	struct sk_buff *msg;
+	void *hdr;
+
+	if (!genl_registered ||
+	    !genl_has_listeners(&msi_ec_genl_family, &init_net, 0))
+		return;
+
+	if (sample->timestamp_ns + slack < genl_telemetry_last + interval)
+		return;
+	genl_telemetry_last = sample->timestamp_ns;
+
+	msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return;
+
+	hdr = genlmsg_put(msg, 0, 0, &msi_ec_genl_family, 0,
+			  MSI_EC_CMD_TELEMETRY);
+	if (!hdr)
+		goto err;
+
+	if (nla_put_u64_64bit(msg, MSI_EC_ATTR_TIMESTAMP, sample->timestamp_ns,
+			      MSI_EC_ATTR_PAD))
+		goto err;
+
+	for (int i = 0; i < MSI_EC_SENSOR_COUNT; i++) {
+		if ((sample->valid & BIT(i)) &&
+		    genl_put_sensor(msg, i, sample->value[i]) < 0)
+			goto err;
+	}
+
+	if ((conf.shift_mode.address != MSI_EC_ADDR_UNSUPP &&
+	     nla_put_u8(msg, MSI_EC_ATTR_SHIFT_MODE, sample->shift_mode)) ||
+	    (conf.fan_mode.address != MSI_EC_ADDR_UNSUPP &&
+	     nla_put_u8(msg, MSI_EC_ATTR_FAN_MODE, sample->fan_mode)) ||
+	    (conf.cooler_boost.address != MSI_EC_ADDR_UNSUPP &&
+	     nla_put_u8(msg, MSI_EC_ATTR_COOLER_BOOST, sample->cooler_boost)))
+		goto err;
+
+	genl_multicast(msg, hdr);
+	return;
+
+err:
+	nlmsg_free(msg);
+}
+
+static unsigned int temp_alarm = 90;
+module_param(temp_alarm, uint, 0644);
+MODULE_PARM_DESC(temp_alarm,
+		 "Temperature in celsius reported when crossed (0 disables it)");
+
+#define MSI_EC_TEMP_ALARM_HYSTERESIS 5
+
+// sampler only
+static bool temp_alarm_raised[MSI_EC_SENSOR_COUNT];
+
+static void msi_ec_temp_alarm_check(const struct msi_ec_sample *sample)
+{
+	const enum msi_ec_sensor temps[] = {
+		MSI_EC_SENSOR_CPU_TEMP,
+		MSI_EC_SENSOR_GPU_TEMP,
+	};
+	unsigned int alarm = READ_ONCE(temp_alarm);
+
+	for (int i = 0; i < ARRAY_SIZE(temps); i++) {
+		enum msi_ec_sensor sensor = temps[i];
+		u8 value = sample->value[sensor];
+
+		if (!alarm || !(sample->valid & BIT(sensor)))
+			continue;
+
+		if (!temp_alarm_raised[sensor] && value >= alarm) {
+			temp_alarm_raised[sensor] = true;
+			msi_ec_genl_event(MSI_EC_EVENT_TEMP_ABOVE, sensor, sample);
+		} else if (temp_alarm_raised[sensor] &&
+			   value + MSI_EC_TEMP_ALARM_HYSTERESIS < alarm) {
+			temp_alarm_raised[sensor] = false;
+			msi_ec_genl_event(MSI_EC_EVENT_TEMP_BELOW, sensor, sample);
+		}
+	}
+}
+
+static void __init msi_ec_genl_register(void)
+{
+	int result;
+
+	result = genl_register_family(&msi_ec_genl_family);
+	if (result < 0) {
+		pr_warn("netlink interface is unavailable (%d)\n", result);
+		return;
+	}
+
+	netlink_register_notifier(&msi_ec_genl_notifier);
+	WRITE_ONCE(genl_registered, true);
+}
+
+static void msi_ec_genl_unregister(void)
+{
+	if (!genl_registered)
+		return;
+
+	WRITE_ONCE(genl_registered, false);
+	netlink_unregister_notifier(&msi_ec_genl_notifier);
+	genl_unregister_family(&msi_ec_genl_family);
+
+	while (!list_empty(&genl_subscribers)) {
+		struct msi_ec_genl_subscriber *subscriber =
+			list_first_entry(&genl_subscribers,
+					 struct msi_ec_genl_subscriber, list);
+
+		list_del(&subscriber->list);
+		kfree(subscriber);
+	}
+}
+
+// ============================================================ //
+// Power source profiles
+// ============================================================ //
+
+enum msi_ec_power_source {
+	MSI_EC_POWER_AC,
+	MSI_EC_POWER_BATTERY,
+	MSI_EC_POWER_UNKNOWN,
+};
+
+// empty strings leave the setting untouched
+struct msi_ec_profile {
+	char *shift_mode;
+	char *fan_mode;
+	char *super_battery; // "on" or "off"
+};
+
+static struct msi_ec_profile power_profiles[2] = {
+	[MSI_EC_POWER_AC]      = { "", "", "" },
+	[MSI_EC_POWER_BATTERY] = { "", "", "" },
+};
+
+module_param_named(ac_shift_mode,
+		   power_profiles[MSI_EC_POWER_AC].shift_mode, charp, 0644);
+MODULE_PARM_DESC(ac_shift_mode, "Shift mode applied when AC is plugged in");
+module_param_named(ac_fan_mode,
+		   power_profiles[MSI_EC_POWER_AC].fan_mode, charp, 0644);
+MODULE_PARM_DESC(ac_fan_mode, "Fan mode applied when AC is plugged in");
+module_param_named(ac_super_battery,
+		   power_profiles[MSI_EC_POWER_AC].super_battery, charp, 0644);
+MODULE_PARM_DESC(ac_super_battery,
+		 "Super battery state (on/off) applied when AC is plugged in");
+module_param_named(battery_shift_mode,
+		   power_profiles[MSI_EC_POWER_BATTERY].shift_mode, charp, 0644);
+MODULE_PARM_DESC(battery_shift_mode, "Shift mode applied when AC is unplugged");
+module_param_named(battery_fan_mode,
+		   power_profiles[MSI_EC_POWER_BATTERY].fan_mode, charp, 0644);
+MODULE_PARM_DESC(battery_fan_mode, "Fan mode applied when AC is unplugged");
+module_param_named(battery_super_battery,
+		   power_profiles[MSI_EC_POWER_BATTERY].super_battery, charp, 0644);
+MODULE_PARM_DESC(battery_super_battery,
+		 "Super battery state (on/off) applied when AC is unplugged");
+
+// only touched by the profile work
+static enum msi_ec_power_source power_source = MSI_EC_POWER_UNKNOWN;
+
+// returns -ENOENT for an empty name
+static int msi_ec_mode_lookup(const struct msi_ec_mode *modes,
+			      const char *name, u8 *value)
+{
+	if (!name[0])
+		return -ENOENT;
+
+	for (int i = 0; modes[i].name; i++) {
+		// NULL entries have NULL name
+
+		if (strcmp_trim_newline2(modes[i].name, name) == 0) {
+			*value = modes[i].value;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+struct msi_ec_profile_writes {
+	bool shift_mode, fan_mode, super_battery;
+	u8 shift_mode_value, fan_mode_value;
+	bool super_battery_on;
+};
+
+static void msi_ec_profile_resolve(enum msi_ec_power_source source,
+				   struct msi_ec_profile_writes *writes)
+{
+	const struct msi_ec_profile *profile = &power_profiles[source];
+	int result;
+
+	memset(writes, 0, sizeof(*writes));
+
+	kernel_param_lock(THIS_MODULE);
+
+	if (conf.shift_mode.address != MSI_EC_ADDR_UNSUPP) {
+		result = msi_ec_mode_lookup(conf.shift_mode.modes,
+					    profile->shift_mode,
+					    &writes->shift_mode_value);
+		writes->shift_mode = result == 0;
+		if (result == -EINVAL)
+			pr_warn("unknown shift mode in profile: %s\n",
+				profile->shift_mode);
+	}
+
+	if (conf.fan_mode.address != MSI_EC_ADDR_UNSUPP) {
+		result = msi_ec_mode_lookup(conf.fan_mode.modes,
+					    profile->fan_mode,
+					    &writes->fan_mode_value);
+		writes->fan_mode = result == 0;
+		if (result == -EINVAL)
+			pr_warn("unknown fan mode in profile: %s\n",
+				profile->fan_mode);
+	}
+
+	if (conf.super_battery.address != MSI_EC_ADDR_UNSUPP) {
+		if (streq(profile->super_battery, "on")) {
+			writes->super_battery = true;
+			writes->super_battery_on = true;
+		} else if (streq(profile->super_battery, "off")) {
+			writes->super_battery = true;
+		} else if (profile->super_battery[0]) {
+			pr_warn("invalid super battery state in profile: %s\n",
+				profile->super_battery);
+		}
+	}
+
+	kernel_param_unlock(THIS_MODULE);
+}
+
+// all writes of a profile happen under a single ec_lock hold
+static int msi_ec_profile_apply(enum msi_ec_power_source source)
+{
+	struct msi_ec_profile_writes writes;
+	int result = 0;
+	u8 stored;
+
+	msi_ec_profile_resolve(source, &writes);
+
+	mutex_lock(&ec_lock);
+
+	if (writes.shift_mode) {
+		result = __ec_write(conf.shift_mode.address,
+				    writes.shift_mode_value);
+		if (result < 0)
+			goto out;
+	}
+
+	if (writes.fan_mode) {
+		result = __ec_write(conf.fan_mode.address,
+				    writes.fan_mode_value);
+		if (result < 0)
+			goto out;
+	}
+
+	if (writes.super_battery) {
+		result = __ec_read_fresh(conf.super_battery.address, &stored);
+		if (result < 0)
+			goto out;
+
+		if (writes.super_battery_on)
+			stored |= conf.super_battery.mask;
+		else
+			stored &= ~conf.super_battery.mask;
+
+		result = __ec_write_bits(conf.super_battery.address, stored,
+					 conf.super_battery.mask);
+	}
+
+out:
+	mutex_unlock(&ec_lock);
+	return result;
+}
+
+static void msi_ec_profile_work_fn(struct work_struct *work)
+{
+	enum msi_ec_power_source source;
+	int result;
+
+	source = power_supply_is_system_supplied() > 0 ?
+		 MSI_EC_POWER_AC : MSI_EC_POWER_BATTERY;
+
+	// battery property changes arrive far more often than plug events
+	if (source == power_source)
+		return;
+
+	power_source = source;
+
+	result = msi_ec_profile_apply(source);
+	if (result < 0)
+		pr_warn("failed to apply %s profile (%d)\n",
+			source == MSI_EC_POWER_AC ? "AC" : "battery", result);
+}
+
+static DECLARE_WORK(msi_ec_profile_work, msi_ec_profile_work_fn);
+
+// the notifier chain is atomic, EC accesses are deferred to the work
+static int msi_ec_power_supply_notify(struct notifier_block *nb,
+				      unsigned long event, void *data)
+{
+	struct power_supply *psy = data;
+
+	if (event != PSY_EVENT_PROP_CHANGED)
+		return NOTIFY_DONE;
+
+	if (psy->desc->type != POWER_SUPPLY_TYPE_MAINS &&
+	    psy->desc->type != POWER_SUPPLY_TYPE_USB)
+		return NOTIFY_DONE;
+
+	schedule_work(&msi_ec_profile_work);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block msi_ec_power_supply_nb = {
+	.notifier_call = msi_ec_power_supply_notify,
+};
+
+static int __init msi_ec_profiles_register(void)
+{
+	// the source at load time is only recorded, profiles apply on changes
+	power_source = power_supply_is_system_supplied() > 0 ?
+		       MSI_EC_POWER_AC : MSI_EC_POWER_BATTERY;
+
+	return power_supply_reg_notifier(&msi_ec_power_supply_nb);
+}
+
+static void msi_ec_profiles_unregister(void)
+{
+	power_supply_unreg_notifier(&msi_ec_power_supply_nb);
+	cancel_work_sync(&msi_ec_profile_work);
+}
+
+// ============================================================ //
+// Hotkey events
+// ============================================================ //
+
+enum msi_ec_hotkey {
+	MSI_EC_HOTKEY_WEBCAM = 1,
+	MSI_EC_HOTKEY_COOLER_BOOST,
+	MSI_EC_HOTKEY_KBD_BL,
+	MSI_EC_HOTKEY_SHIFT_MODE,
+};
+
+static const struct key_entry msi_ec_keymap[] = {
+	{ KE_KEY,    MSI_EC_HOTKEY_WEBCAM,       { KEY_CAMERA } },
+	{ KE_KEY,    MSI_EC_HOTKEY_COOLER_BOOST, { KEY_PROG1 } },
+	// reported by the led classdev, the EC has already switched it
+	{ KE_IGNORE, MSI_EC_HOTKEY_KBD_BL,       { KEY_KBDILLUMTOGGLE } },
+	{ KE_KEY,    MSI_EC_HOTKEY_SHIFT_MODE,   { KEY_PROG2 } },
+	{ KE_END, 0 }
+};
+
+// published under ec_lock once it is registered
+static struct input_dev *msi_ec_input;
+
+// field changed by the EC when a hotkey is pressed
+static const enum msi_ec_field_id msi_ec_hotkey_fields[] = {
+	[MSI_EC_HOTKEY_WEBCAM]       = MSI_EC_FIELD_WEBCAM,
+	[MSI_EC_HOTKEY_COOLER_BOOST] = MSI_EC_FIELD_COOLER_BOOST,
+	[MSI_EC_HOTKEY_KBD_BL]       = MSI_EC_FIELD_KBD_BACKLIGHT,
+	[MSI_EC_HOTKEY_SHIFT_MODE]   = MSI_EC_FIELD_SHIFT_MODE,
+};
+
+// last value of each hotkey register and the driver writes it reflects,
+// guarded by ec_lock
+static struct {
+	bool valid;
+	u8 value;
+	u32 writes;
+} hotkey_seen[ARRAY_SIZE(msi_ec_hotkey_fields)];
+
+// must be called with ec_lock held; reports the hotkey when its bits
+// changed since they were last seen and no write of this driver did it
+static void __hotkey_check(enum msi_ec_hotkey key, u8 value)
+{
+	const struct msi_ec_field *field = &msi_ec_fields[msi_ec_hotkey_fields[key]];
+	u32 writes = ec_cache[field->address].writes;
+	const struct key_entry *entry;
+	bool changed;
+
+	if (!msi_ec_input)
+		return;
+
+	changed = hotkey_seen[key].valid && hotkey_seen[key].writes == writes &&
+		  ((hotkey_seen[key].value ^ value) & field->mask);
+
+	hotkey_seen[key].valid = true;
+	hotkey_seen[key].value = value;
+	hotkey_seen[key].writes = writes;
+
+	if (!changed)
+		return;
+
+	if (key == MSI_EC_HOTKEY_KBD_BL)
+		led_classdev_notify_brightness_hw_changed(&msiacpi_led_kbdlight,
+							  value & field->mask);
+
+	sparse_keymap_report_event(msi_ec_input, key, 1, true);
+
+	entry = sparse_keymap_entry_from_scancode(msi_ec_input, key);
+	if (entry)
+		msi_ec_genl_event(MSI_EC_EVENT_HOTKEY, entry->keycode, NULL);
+}
+
+// The EC does not tell when a hotkey is pressed: the sampler compares the
+// hotkey registers on every pass, with ec_lock held. The first pass after
+// an idle period only records them.
+static void __hotkeys_check(const union msi_ec_snapshot *snapshot,
+			    bool report)
+{
+	u8 raw;
+
+	for (int key = MSI_EC_HOTKEY_WEBCAM; key <= MSI_EC_HOTKEY_SHIFT_MODE; key++) {
+		if (!snapshot_field(snapshot, msi_ec_hotkey_fields[key], &raw))
+			continue;
+
+		if (!report)
+			hotkey_seen[key].valid = false;
+		__hotkey_check(key, raw);
+	}
+}
+
+static bool msi_ec_notify_installed;
+
+// the sampler runs while someone listens to the hotkeys
+static int msi_ec_input_open(struct input_dev *input)
+{
+	msi_ec_sampler_get();
+	return 0;
+}
+
+static void msi_ec_input_close(struct input_dev *input)
+{
+	msi_ec_sampler_put();
+}
+
+// Some firmwares also notify the EC device when they run a hotkey method,
+// the registers are then checked right away instead of on the next pass
+static void msi_ec_notify(acpi_handle handle, u32 event, void *data)
+{
+	mutex_lock(&ec_lock);
+
+	for (int key = MSI_EC_HOTKEY_WEBCAM; key <= MSI_EC_HOTKEY_SHIFT_MODE; key++) {
+		const struct msi_ec_field *field = &msi_ec_fields[msi_ec_hotkey_fields[key]];
+		u8 raw;
+
+		if (msi_ec_field_supported(field) &&
+		    __ec_read_fresh(field->address, &raw) >= 0)
+			__hotkey_check(key, raw);
+	}
+
+	mutex_unlock(&ec_lock);
+}
+
+static int __init msi_ec_input_setup(struct device *parent)
+{
+	struct input_dev *input;
+	acpi_handle ec_handle;
+	acpi_status status;
+	int result;
+
+	input = input_allocate_device();
+	if (!input)
+		return -ENOMEM;
+
+	input->name = "MSI EC hotkeys";
+	input->phys = MSI_EC_DRIVER_NAME "/input0";
+	input->id.bustype = BUS_HOST;
+	input->dev.parent = parent;
+	input->open = msi_ec_input_open;
+	input->close = msi_ec_input_close;
+
+	result = sparse_keymap_setup(input, msi_ec_keymap, NULL);
+	if (result < 0)
+		goto err_free;
+
+	result = input_register_device(input);
+	if (result < 0)
+		goto err_free;
+
+	// changes are detected against the values of the next sampler pass
+	mutex_lock(&ec_lock);
+	msi_ec_input = input;
+	mutex_unlock(&ec_lock);
+
+	// an extra trigger, the sampler reports the hotkeys without it
+	ec_handle = ec_get_handle();
+	if (ec_handle) {
+		status = acpi_install_notify_handler(ec_handle, ACPI_DEVICE_NOTIFY,
+						     msi_ec_notify, NULL);
+		if (ACPI_FAILURE(status))
+			pr_warn("EC notifications are unavailable\n");
+		else
+			msi_ec_notify_installed = true;
+	}
+
+	return 0;
+
+err_free:
+	input_free_device(input);
+	return result;
+}
+
+static void msi_ec_input_remove(void)
+{
+	struct input_dev *input;
+
+	if (msi_ec_notify_installed)
+		acpi_remove_notify_handler(ec_get_handle(), ACPI_DEVICE_NOTIFY,
+					   msi_ec_notify);
+
+	mutex_lock(&ec_lock);
+	input = msi_ec_input;
+	msi_ec_input = NULL;
+	mutex_unlock(&ec_lock);
+
+	if (input)
+		input_unregister_device(input);
+}
+
+// ============================================================ //
+// Debugfs EC map
+// ============================================================ //
+
+static bool ec_map_write;
+module_param(ec_map_write, bool, 0444);
+MODULE_PARM_DESC(ec_map_write,
+		 "Allow writing EC registers through debugfs msi-ec/ec_map (needs CAP_SYS_RAWIO)");
+
+static bool discovery_mode; // read-only, without a configuration
+static struct dentry *msi_ec_debugfs;
+
+// reads the requested range in one ec_lock hold, bypassing the cache
+static ssize_t ec_map_read(struct file *file, char __user *ubuf,
+			   size_t count, loff_t *ppos)
+{
+	u8 map[256];
+	loff_t off = *ppos;
+	int result = 0;
+
+	if (off >= sizeof(map))
+		return 0;
+	count = min_t(size_t, count, sizeof(map) - off);
+
+	mutex_lock(&ec_lock);
+	for (int addr = off; addr < off + count && result >= 0; addr++)
+		result = ec_read(addr, &map[addr]);
+	mutex_unlock(&ec_lock);
+
+	if (result < 0)
+		return result;
+
+	if (copy_to_user(ubuf, map + off, count))
+		return -EFAULT;
+
+	*ppos += count;
+	return count;
+}
+
+// patches the written range through the register cache
+static ssize_t ec_map_write_fn(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	u8 map[256];
+	loff_t off = *ppos;
+	int result = 0;
+
+	if (!ec_map_write || discovery_mode || !capable(CAP_SYS_RAWIO))
+		return -EPERM;
+
+	if (off >= sizeof(map))
+		return -ENOSPC;
+	count = min_t(size_t, count, sizeof(map) - off);
+
+	if (copy_from_user(map + off, ubuf, count))
+		return -EFAULT;
+
+	// only the bytes that differ from the current map are written, so
+	// writing back a dump leaves status and read-only registers alone
+	mutex_lock(&ec_lock);
+	for (int addr = off; addr < off + count && result >= 0; addr++) {
+		u8 stored;
+
+		result = __ec_read_fresh(addr, &stored);
+		if (result >= 0 && stored != map[addr])
+			result = __ec_write(addr, map[addr]);
+	}
+	mutex_unlock(&ec_lock);
+
+	if (result < 0)
+		return result;
+
+	*ppos += count;
+	return count;
+}
+
+static const struct file_operations ec_map_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ec_map_read,
+	.write = ec_map_write_fn,
+	.llseek = default_llseek,
+};
+
+static void ec_map_annotate(const char **names, int address, const char *name)
+{
+	if (address < 0 || address > 0xff || !name)
+		return;
+
+	// the first name wins, later ones are rare aliases
+	if (!names[address])
+		names[address] = name;
+}
+
+// one "<addr> <value> <field>" line per register
+static int ec_map_annotated_show(struct seq_file *m, void *v)
+{
+	const char **names;
+	u8 map[256];
+	int result = 0;
+
+	names = kcalloc(256, sizeof(*names), GFP_KERNEL);
+	if (!names)
+		return -ENOMEM;
+
+	for (int i = 0; i < MSI_EC_FW_VERSION_LENGTH; i++)
+		ec_map_annotate(names, MSI_EC_FW_VERSION_ADDRESS + i, "fw_version");
+	for (int i = 0; i < MSI_EC_FW_DATE_LENGTH; i++)
+		ec_map_annotate(names, MSI_EC_FW_DATE_ADDRESS + i, "fw_release_date");
+	for (int i = 0; i < MSI_EC_FW_TIME_LENGTH; i++)
+		ec_map_annotate(names, MSI_EC_FW_TIME_ADDRESS + i, "fw_release_time");
+
+	if (!discovery_mode) {
+		for (int i = 0; i < MSI_EC_FIELD_COUNT; i++)
+			ec_map_annotate(names, msi_ec_fields[i].address,
+					msi_ec_fields[i].name);
+
+		ec_map_annotate(names, conf.kbd_bl.bl_mode_address, "kbd_bl_mode");
+
+		for (int i = 0; i < MSI_EC_FAN_CURVE_SPEEDS; i++) {
+			if (i < MSI_EC_FAN_CURVE_TEMPS &&
+			    conf.fan_curve.cpu_temp_address != MSI_EC_ADDR_UNSUPP)
+				ec_map_annotate(names, conf.fan_curve.cpu_temp_address + i,
+						"fan_curve/cpu_temp");
+			if (conf.fan_curve.cpu_speed_address != MSI_EC_ADDR_UNSUPP)
+				ec_map_annotate(names, conf.fan_curve.cpu_speed_address + i,
+						"fan_curve/cpu_speed");
+			if (i < MSI_EC_FAN_CURVE_TEMPS &&
+			    conf.fan_curve.gpu_temp_address != MSI_EC_ADDR_UNSUPP)
+				ec_map_annotate(names, conf.fan_curve.gpu_temp_address + i,
+						"fan_curve/gpu_temp");
+			if (conf.fan_curve.gpu_speed_address != MSI_EC_ADDR_UNSUPP)
+				ec_map_annotate(names, conf.fan_curve.gpu_speed_address + i,
+						"fan_curve/gpu_speed");
+		}
+	}
+
+	mutex_lock(&ec_lock);
+	for (int addr = 0; addr < 256 && result >= 0; addr++)
+		result = ec_read(addr, &map[addr]);
+	mutex_unlock(&ec_lock);
+
+	if (result < 0)
+		goto out;
+
+	for (int addr = 0; addr < 256; addr++)
+		seq_printf(m, "0x%02x 0x%02x %s\n", addr, map[addr],
+			   names[addr] ?: "-");
+
+out:
+	kfree(names);
+	return result;
+}
+DEFINE_SHOW_ATTRIBUTE(ec_map_annotated);
+
+static void __init msi_ec_debugfs_init(void)
+{
+	umode_t mode = ec_map_write && !discovery_mode ? 0600 : 0400;
+
+	msi_ec_debugfs = debugfs_create_dir(MSI_EC_DRIVER_NAME, NULL);
+	debugfs_create_file_size("ec_map", mode, msi_ec_debugfs, NULL,
+				 &ec_map_fops, 256);
+	debugfs_create_file("ec_map_annotated", 0400, msi_ec_debugfs, NULL,
+			    &ec_map_annotated_fops);
+
+	if (!discovery_mode)
+		debugfs_create_file("volatility", 0400, msi_ec_debugfs, NULL,
+				    &volatility_fops);
+}
+
+static void msi_ec_debugfs_remove(void)
+{
+	debugfs_remove_recursive(msi_ec_debugfs);
+}
+
+// ============================================================ //
+// Discovery mode
+// ============================================================ //
+
+static bool discover;
+module_param(discover, bool, 0444);
+MODULE_PARM_DESC(discover,
+		 "Load on unsupported firmware in read-only discovery mode (see debugfs msi-ec/discovery)");
+
+#define MSI_EC_DISCOVERY_INTERVAL_MS 1000
+#define MSI_EC_DISCOVERY_SAMPLES     3600 // an hour, keeps the sums in range
+#define MSI_EC_DISCOVERY_CORR_MIN    500  // permille
+
+struct msi_ec_discovery_reg {
+	u8 min;
+	u8 max;
+	u32 changes;
+	s64 sum;
+	s64 sum_sq;
+	s64 sum_load; // value * cpu load
+};
+
+// Snapshots of the whole EC map are correlated with the cpu load, so
+// registers following a load pattern stand out; nothing is written
+static struct {
+	struct msi_ec_discovery_reg reg[256];
+	u8 prev[256];
+	u32 samples;
+	s64 load_sum;
+	s64 load_sum_sq;
+	u64 idle_us; // totals of the previous sample
+	u64 wall_us;
+	bool stopped; // cpu load unavailable
+	u8 fw_version[MSI_EC_FW_VERSION_LENGTH + 1];
+} discovery_state;
+
+static DEFINE_MUTEX(discovery_lock); // guards discovery_state
+
+// permille of busy cpu time since the previous call, -EAGAIN until there
+// is a previous call to compare with, -ENODEV when the kernel does not
+// account idle time (nohz disabled)
+static int discovery_cpu_load(void)
+{
+	u64 idle = 0, wall = 0;
+	int load = -EAGAIN;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		u64 cpu_wall;
+		u64 cpu_idle = get_cpu_idle_time_us(cpu, &cpu_wall);
+
+		if (cpu_idle == -1ULL)
+			return -ENODEV;
+
+		idle += cpu_idle;
+		wall += cpu_wall;
+	}
+
+	// cpu hotplug makes the totals go backwards, start over
+	if (discovery_state.wall_us && wall > discovery_state.wall_us &&
+	    idle >= discovery_state.idle_us)
+		load = 1000 - div64_u64(1000 * (idle - discovery_state.idle_us),
+					wall - discovery_state.wall_us);
+
+	discovery_state.idle_us = idle;
+	discovery_state.wall_us = wall;
+
+	return load < 0 ? load : clamp(load, 0, 1000);
+}
+
+static void discovery_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(discovery_work, discovery_fn);
+
+static void discovery_fn(struct work_struct *work)
+{
+	u8 snapshot[256];
+	int result = 0;
+	int load;
+
+	// single byte reads, the EC has no block read available to modules
+	mutex_lock(&ec_lock);
+	for (int addr = 0; addr < 256 && result >= 0; addr++)
+		result = ec_read(addr, &snapshot[addr]);
+	mutex_unlock(&ec_lock);
+
+	mutex_lock(&discovery_lock);
+
+	load = discovery_cpu_load();
+	if (load == -ENODEV) {
+		// nothing could ever be recorded, stop reading the EC
+		pr_warn("discovery stopped, cpu idle time is not available (nohz disabled?)\n");
+		discovery_state.stopped = true;
+		goto out;
+	}
+	if (result < 0 || load < 0)
+		goto out;
+
+	for (int addr = 0; addr < 256; addr++) {
+		struct msi_ec_discovery_reg *reg = &discovery_state.reg[addr];
+		s64 value = snapshot[addr];
+
+		if (discovery_state.samples == 0) {
+			reg->min = reg->max = snapshot[addr];
+		} else {
+			reg->min = min(reg->min, snapshot[addr]);
+			reg->max = max(reg->max, snapshot[addr]);
+			if (snapshot[addr] != discovery_state.prev[addr])
+				reg->changes++;
+		}
+
+		reg->sum += value;
+		reg->sum_sq += value * value;
+		reg->sum_load += value * load;
+	}
+
+	memcpy(discovery_state.prev, snapshot, sizeof(snapshot));
+	discovery_state.load_sum += load;
+	discovery_state.load_sum_sq += (s64)load * load;
+	discovery_state.samples++;
+
+out:
+	if (!discovery_state.stopped &&
+	    discovery_state.samples < MSI_EC_DISCOVERY_SAMPLES)
+		schedule_delayed_work(&discovery_work,
+				      msecs_to_jiffies(MSI_EC_DISCOVERY_INTERVAL_MS));
+
+	mutex_unlock(&discovery_lock);
+}
+
+// Pearson correlation of a register with the cpu load, permille;
+// must be called with discovery_lock held
+static int discovery_corr(const struct msi_ec_discovery_reg *reg)
+{
+	s64 n = discovery_state.samples;
+	s64 cov = n * reg->sum_load - reg->sum * discovery_state.load_sum;
+	s64 var = n * reg->sum_sq - reg->sum * reg->sum;
+	s64 load_var = n * discovery_state.load_sum_sq -
+		       discovery_state.load_sum * discovery_state.load_sum;
+	u64 denominator = (u64)int_sqrt64(max(var, 0LL)) *
+			  int_sqrt64(max(load_var, 0LL));
+
+	if (!denominator)
+		return 0;
+
+	return div64_s64(cov * 1000, denominator);
+}
+
+// plausible celsius values that moved with the load
+static bool discovery_temp_candidate(const struct msi_ec_discovery_reg *reg)
+{
+	return reg->min >= 20 && reg->max <= 110 && reg->max - reg->min >= 5;
+}
+
+static void discovery_print_address(struct seq_file *m, const char *field,
+				    int addr, int corr)
+{
+	if (addr < 0)
+		seq_printf(m, "\t\t.%-21s = MSI_EC_ADDR_UNKNOWN,\n", field);
+	else
+		seq_printf(m, "\t\t.%-21s = 0x%02x, // load correlation %d.%03d, needs testing\n",
+			   field, addr, corr / 1000, abs(corr) % 1000);
+}
+
+static int discovery_show(struct seq_file *m, void *v)
+{
+	int temp = -1, fan = -1;
+	int temp_corr = 0, fan_corr = 0;
+
+	mutex_lock(&discovery_lock);
+
+	seq_printf(m, "firmware: %s\n", discovery_state.fw_version);
+	seq_printf(m, "samples: %u of %u, every %u ms\n",
+		   discovery_state.samples, MSI_EC_DISCOVERY_SAMPLES,
+		   MSI_EC_DISCOVERY_INTERVAL_MS);
+	if (discovery_state.stopped)
+		seq_puts(m, "stopped: cpu idle time is not available\n");
+	seq_puts(m, "\naddr  min  max  changes  load correlation\n");
+
+	for (int addr = 0; addr < 256; addr++) {
+		const struct msi_ec_discovery_reg *reg = &discovery_state.reg[addr];
+		int corr;
+
+		if (!reg->changes)
+			continue;
+
+		corr = discovery_corr(reg);
+		seq_printf(m, "0x%02x  %3u  %3u  %7u  %s%d.%03d\n", addr,
+			   reg->min, reg->max, reg->changes, corr < 0 ? "-" : " ",
+			   abs(corr) / 1000, abs(corr) % 1000);
+
+		if (corr < MSI_EC_DISCOVERY_CORR_MIN)
+			continue;
+
+		if (discovery_temp_candidate(reg) && corr > temp_corr) {
+			temp = addr;
+			temp_corr = corr;
+		}
+	}
+
+	// the best correlated register left is the fan speed candidate
+	for (int addr = 0; addr < 256; addr++) {
+		const struct msi_ec_discovery_reg *reg = &discovery_state.reg[addr];
+		int corr;
+
+		if (!reg->changes || addr == temp)
+			continue;
+
+		corr = discovery_corr(reg);
+		if (corr >= MSI_EC_DISCOVERY_CORR_MIN && corr > fan_corr) {
+			fan = addr;
+			fan_corr = corr;
+		}
+	}
+
+	seq_puts(m, "\n// suggested configuration, every address needs testing\n");
+	seq_printf(m, "static const char *ALLOWED_FW_NEW[] __initconst = {\n\t\"%s\",\n\tNULL\n};\n\n",
+		   discovery_state.fw_version);
+	seq_puts(m, "static struct msi_ec_conf CONF_NEW __initdata = {\n");
+	seq_puts(m, "\t.allowed_fw = ALLOWED_FW_NEW,\n");
+	seq_puts(m, "\t.cpu = {\n");
+	discovery_print_address(m, "rt_temp_address", temp, temp_corr);
+	discovery_print_address(m, "rt_fan_speed_address", fan, fan_corr);
+	if (fan >= 0) {
+		seq_printf(m, "\t\t.%-21s = 0x%02x,\n", "rt_fan_speed_base_min",
+			   discovery_state.reg[fan].min);
+		seq_printf(m, "\t\t.%-21s = 0x%02x,\n", "rt_fan_speed_base_max",
+			   discovery_state.reg[fan].max);
+	}
+	discovery_print_address(m, "bs_fan_speed_address", -1, 0);
+	seq_puts(m, "\t},\n");
+	seq_puts(m, "\t// other features are MSI_EC_ADDR_UNKNOWN until found\n");
+	seq_puts(m, "};\n");
+
+	mutex_unlock(&discovery_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(discovery);
+
+static int __init msi_ec_discovery_start(void)
+{
+	ec_get_firmware_version(discovery_state.fw_version);
+
+	discovery_mode = true;
+
+	msi_ec_debugfs_init();
+	debugfs_create_file("discovery", 0400, msi_ec_debugfs, NULL,
+			    &discovery_fops);
+	schedule_delayed_work(&discovery_work, 0);
+
+	pr_warn("running read-only discovery, see debugfs %s/discovery\n",
+		MSI_EC_DRIVER_NAME);
+	return 0;
+}
+
+static void msi_ec_discovery_stop(void)
+{
+	msi_ec_debugfs_remove();
+	cancel_delayed_work_sync(&discovery_work);
+}
+
+// ============================================================ //
+// Module load/unload
+// ============================================================ //
+
+static void __init use_configuration(const struct msi_ec_conf *configuration)
+{
+	memcpy(&conf, configuration, sizeof(struct msi_ec_conf));
+	conf.allowed_fw = NULL;
+}
+
+// must be called before msi_platform_probe()
+static int __init load_configuration(void)
+{
+	const struct dmi_system_id *dmi = dmi_first_match(msi_ec_dmi_table);
+	const struct msi_ec_conf *dmi_conf = dmi ? dmi->driver_data : NULL;
+	int result;
+
+	// known boards need no EC reads
+	if (dmi_conf && !fw_check) {
+		pr_info("using the configuration of %s\n", dmi->ident);
+		use_configuration(dmi_conf);
+		return 0;
+	}
+
+	// get firmware version
+	u8 ver[MSI_EC_FW_VERSION_LENGTH + 1];
+	result = ec_get_firmware_version(ver);
+	if (result < 0) {
+		return result;
+	}
+
+	if (dmi_conf) {
+		if (match_string(dmi_conf->allowed_fw, -1, ver) != -EINVAL) {
+			use_configuration(dmi_conf);
+			return 0;
+		}
+
+		pr_warn("firmware %s is not known for %s\n", ver, dmi->ident);
+	}
+
+	// load the suitable configuration, if exists
+	for (int i = 0; CONFIGURATIONS[i]; i++) {
+		if (match_string(CONFIGURATIONS[i]->allowed_fw, -1, ver) != -EINVAL) {
+			use_configuration(CONFIGURATIONS[i]);
+			return 0;
+		}
+	}
+
+	pr_err("Your firmware version is not supported!\n");
+	return -EOPNOTSUPP;
+}
+
+static int __init msi_ec_init(void)
+{
+	int result;
+
+	result = load_configuration();
+	if (result == -EOPNOTSUPP && discover)
+		return msi_ec_discovery_start();
+	if (result < 0)
+		return result;
+
+	msi_ec_fields_init();
+	cooler_boost_timer_init();
+	cpu_fan_range_init();
+	fan_curve_init();
+
+	ec_cache_init();
+
+	result = platform_driver_register(&msi_platform_driver);
+	if (result < 0)
+		return result;
 
 	msi_platform_device = platform_device_alloc(MSI_EC_DRIVER_NAME, -1);
 	if (msi_platform_device == NULL) {
@@ -1891,12 +6486,52 @@ static int __init msi_ec_init(void)
 	if (conf.kbd_bl.bl_state_address != MSI_EC_ADDR_UNSUPP)
 		led_classdev_register(&msi_platform_device->dev, &msiacpi_led_kbdlight);
 
+	msi_ec_genl_register();
+	msi_ec_sampler_start();
+	msi_ec_pmu_register();
+	msi_ec_bpf_register();
+
+	result = misc_register(&msi_ec_miscdev);
+	if (result < 0)
+		pr_warn("sample stream is unavailable (%d)\n", result);
+	else
+		msi_ec_miscdev_registered = true;
+
+	result = msi_ec_profiles_register();
+	if (result < 0)
+		pr_warn("power source profiles are unavailable (%d)\n", result);
+
+	// hotkeys are optional, the rest of the driver works without them
+	result = msi_ec_input_setup(&msi_platform_device->dev);
+	if (result < 0)
+		pr_warn("hotkey events are unavailable (%d)\n", result);
+
+	msi_ec_debugfs_init();
+
 	pr_info("module_init\n");
 	return 0;
 }
 
 static void __exit msi_ec_exit(void)
 {
+	if (discovery_mode) {
+		msi_ec_discovery_stop();
+		pr_info("module_exit\n");
+		return;
+	}
+
+	msi_ec_debugfs_remove();
+	msi_ec_input_remove();
+
+	msi_ec_profiles_unregister();
+
+	if (msi_ec_miscdev_registered)
+		misc_deregister(&msi_ec_miscdev);
+
+	msi_ec_pmu_unregister();
+	msi_ec_sampler_stop();
+	msi_ec_genl_unregister();
+
 	// unregister LED classdevs
 	if (conf.leds.micmute_led_address != MSI_EC_ADDR_UNSUPP)
 		led_classdev_unregister(&micmute_led_cdev);
@@ -1908,10 +6543,14 @@ static void __exit msi_ec_exit(void)
 		led_classdev_unregister(&msiacpi_led_kbdlight);
 
 	battery_hook_unregister(&battery_hook);
+	cancel_work_sync(&msi_battery_changed_work);
 
 	platform_driver_unregister(&msi_platform_driver);
 	platform_device_del(msi_platform_device);
 
+	// after the attributes are gone, nothing can re-arm the timer
+	cooler_boost_timer_stop();
+
 	pr_info("module_exit\n");
 }
 
@@ -0,0 +1,221 @@
+#ifndef __MSI_EC_UAPI__
+#define __MSI_EC_UAPI__
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// Binary interfaces shared with userspace
+
+enum msi_ec_sensor {
+	MSI_EC_SENSOR_CPU_TEMP, // celsius
+	MSI_EC_SENSOR_CPU_FAN,  // percent
+	MSI_EC_SENSOR_GPU_TEMP, // celsius
+	MSI_EC_SENSOR_GPU_FAN,  // percent
+	MSI_EC_SENSOR_COUNT,
+};
+
+// Fields of the EC configuration
+enum msi_ec_field_id {
+	MSI_EC_FIELD_WEBCAM,              // 0 or 1
+	MSI_EC_FIELD_WEBCAM_BLOCK,        // 0 or 1
+	MSI_EC_FIELD_FN_WIN_SWAP,         // 1: fn key on the right
+	MSI_EC_FIELD_COOLER_BOOST,        // 0 or 1
+	MSI_EC_FIELD_SHIFT_MODE,          // raw register value
+	MSI_EC_FIELD_SUPER_BATTERY,       // 0 or 1
+	MSI_EC_FIELD_FAN_MODE,            // raw register value
+	MSI_EC_FIELD_CHARGE_END,          // percent
+	MSI_EC_FIELD_CPU_TEMP,            // celsius
+	MSI_EC_FIELD_CPU_FAN_SPEED,       // percent
+	MSI_EC_FIELD_CPU_BASIC_FAN_SPEED, // percent
+	MSI_EC_FIELD_GPU_TEMP,            // celsius
+	MSI_EC_FIELD_GPU_FAN_SPEED,       // percent
+	MSI_EC_FIELD_MICMUTE_LED,         // 0 or 1
+	MSI_EC_FIELD_MUTE_LED,            // 0 or 1
+	MSI_EC_FIELD_KBD_BACKLIGHT,       // 0 - 3
+	MSI_EC_FIELD_COUNT,
+};
+
+struct msi_ec_field_value {
+	__u32 id;    // enum msi_ec_field_id
+	__u32 value;
+	__s32 error; // out of GET_FIELDS, 0 or a negative errno for this field
+};
+
+// Field descriptors, MSI_EC_IOC_GET_SCHEMA
+enum msi_ec_unit {
+	MSI_EC_UNIT_BOOL,    // 0 or 1
+	MSI_EC_UNIT_ENUM,    // one of the labels
+	MSI_EC_UNIT_CELSIUS,
+	MSI_EC_UNIT_PERCENT,
+	MSI_EC_UNIT_LEVEL,   // min - max
+};
+
+#define MSI_EC_SCHEMA_FIELD_SUPPORTED (1 << 0) // present on this laptop
+#define MSI_EC_SCHEMA_FIELD_WRITABLE  (1 << 1) // accepted by SET_FIELDS
+
+#define MSI_EC_SCHEMA_NAME_LEN   32
+#define MSI_EC_SCHEMA_LABEL_LEN  20
+#define MSI_EC_SCHEMA_LABELS_MAX 8
+
+struct msi_ec_schema_label {
+	__u32 value;
+	char name[MSI_EC_SCHEMA_LABEL_LEN];
+};
+
+struct msi_ec_schema_field {
+	__u32 id;    // enum msi_ec_field_id
+	__u32 flags; // MSI_EC_SCHEMA_FIELD_*
+	__u32 unit;  // enum msi_ec_unit
+	__u32 scale; // value / scale is in unit
+	__u32 min;
+	__u32 max;
+	__u32 label_count;
+	char name[MSI_EC_SCHEMA_NAME_LEN]; // sysfs attribute path
+	struct msi_ec_schema_label labels[MSI_EC_SCHEMA_LABELS_MAX];
+};
+
+// A field stored in struct msi_ec_sample
+#define MSI_EC_SCHEMA_NO_VALID_BIT 0xff
+
+struct msi_ec_schema_column {
+	__u32 field;     // enum msi_ec_field_id
+	__u16 offset;    // in struct msi_ec_sample
+	__u8 size;       // bytes, little endian
+	__u8 valid_bit;  // in msi_ec_sample.valid, or MSI_EC_SCHEMA_NO_VALID_BIT
+};
+
+// Advanced fan mode curve, /sys/devices/platform/msi-ec/fan_curve
+// speed[0] applies below temp[0], speed[i] from temp[i - 1] on
+#define MSI_EC_FAN_CURVE_TEMPS  6
+#define MSI_EC_FAN_CURVE_SPEEDS (MSI_EC_FAN_CURVE_TEMPS + 1)
+
+struct msi_ec_fan_curve {
+	__u8 cpu_temp[MSI_EC_FAN_CURVE_TEMPS];   // celsius, ascending
+	__u8 cpu_speed[MSI_EC_FAN_CURVE_SPEEDS]; // percent, up to the laptop's limit
+	__u8 gpu_temp[MSI_EC_FAN_CURVE_TEMPS];
+	__u8 gpu_speed[MSI_EC_FAN_CURVE_SPEEDS];
+};
+
+// Time-in-bucket histograms, /sys/devices/platform/msi-ec/histograms
+#define MSI_EC_HIST_BUCKET_WIDTH 5
+#define MSI_EC_HIST_BUCKETS      21 // the last bucket is open-ended
+
+struct msi_ec_histograms {
+	__u64 time_ms; // accounted since the last reset
+	__u64 bucket_ms[MSI_EC_SENSOR_COUNT][MSI_EC_HIST_BUCKETS];
+};
+
+// Downsampled history, /sys/devices/platform/msi-ec/history
+#define MSI_EC_HISTORY_TIERS 3
+
+struct msi_ec_history_slot {
+	__u8 min; // min > max marks a window without samples
+	__u8 max;
+	__u8 avg;
+};
+
+struct msi_ec_history_tier {
+	__u32 period_s;
+	__u32 length; // slots
+	__u32 head;   // slot to be written next
+	__u32 count;  // valid slots, up to length
+	__u64 window; // index of the newest slot, monotonic time / period_s
+};
+
+// followed by the slots of every tier: length * MSI_EC_SENSOR_COUNT slots
+// per tier, the sensors of a window being stored next to each other
+struct msi_ec_history_header {
+	__u32 tier_count;
+	__u32 sensor_count;
+	struct msi_ec_history_tier tier[MSI_EC_HISTORY_TIERS];
+};
+
+// Sample stream, read() from /dev/msi-ec
+struct msi_ec_sample {
+	__u64 seq;
+	__u64 timestamp_ns; // CLOCK_MONOTONIC
+	__u8 value[MSI_EC_SENSOR_COUNT];
+	__u8 valid;         // bitmask of valid values
+	__u8 shift_mode;    // raw register value
+	__u8 fan_mode;      // raw register value
+	__u8 cooler_boost;  // 0 or 1
+};
+
+struct msi_ec_stream_stats {
+	__u64 head;     // seq of the next record to be produced
+	__u64 cursor;   // seq of the next record to be read by this reader
+	__u64 overruns; // records missed by this reader
+};
+
+// Bumped on incompatible changes of the ioctls below
+#define MSI_EC_IOC_VERSION 1
+
+#define MSI_EC_IOC_FIELDS_MAX 64 // entries per MSI_EC_IOC_*_FIELDS call
+
+struct msi_ec_fields {
+	__u32 count;  // entries at values, on return of SET_FIELDS the applied ones
+	__u32 flags;  // must be 0
+	__u64 values; // pointer to struct msi_ec_field_value[count]
+};
+
+// On input the capacity of the arrays, on return the number of entries
+// the driver has, of which the first min(capacity, count) are filled
+struct msi_ec_schema {
+	__u32 version;      // out, MSI_EC_IOC_VERSION
+	__u32 sample_size;  // out, sizeof(struct msi_ec_sample)
+	__u32 field_count;
+	__u32 column_count;
+	__u64 fields;       // pointer to struct msi_ec_schema_field[]
+	__u64 columns;      // pointer to struct msi_ec_schema_column[]
+};
+
+#define MSI_EC_IOC_MAGIC 0xEC
+
+#define MSI_EC_IOC_STREAM_STATS _IOR(MSI_EC_IOC_MAGIC, 0x01, struct msi_ec_stream_stats)
+#define MSI_EC_IOC_GET_VERSION _IOR(MSI_EC_IOC_MAGIC, 0x02, __u32)
+#define MSI_EC_IOC_GET_FIELDS _IOWR(MSI_EC_IOC_MAGIC, 0x03, struct msi_ec_fields)
+#define MSI_EC_IOC_SET_FIELDS _IOWR(MSI_EC_IOC_MAGIC, 0x04, struct msi_ec_fields)
+#define MSI_EC_IOC_GET_SCHEMA _IOWR(MSI_EC_IOC_MAGIC, 0x05, struct msi_ec_schema)
+
+// Generic netlink family, all messages go to a single multicast group
+#define MSI_EC_GENL_NAME    "msi_ec"
+#define MSI_EC_GENL_VERSION 1
+#define MSI_EC_GENL_MCGRP   "monitor"
+
+enum msi_ec_genl_cmd {
+	MSI_EC_CMD_UNSPEC,
+	MSI_EC_CMD_SET_RATE,  // request telemetry every INTERVAL_MS, 0 cancels
+	MSI_EC_CMD_TELEMETRY, // sensor snapshot
+	MSI_EC_CMD_EVENT,     // state change
+	__MSI_EC_CMD_MAX,
+};
+#define MSI_EC_CMD_MAX (__MSI_EC_CMD_MAX - 1)
+
+enum msi_ec_genl_attr {
+	MSI_EC_ATTR_UNSPEC,
+	MSI_EC_ATTR_PAD,
+	MSI_EC_ATTR_INTERVAL_MS,  // u32, the reply carries the effective one
+	MSI_EC_ATTR_TIMESTAMP,    // u64, CLOCK_MONOTONIC ns
+	MSI_EC_ATTR_SENSOR,       // nested, one per valid sensor
+	MSI_EC_ATTR_SENSOR_ID,    // u32, enum msi_ec_sensor
+	MSI_EC_ATTR_SENSOR_VALUE, // u32
+	MSI_EC_ATTR_SHIFT_MODE,   // u8, raw register value
+	MSI_EC_ATTR_FAN_MODE,     // u8, raw register value
+	MSI_EC_ATTR_COOLER_BOOST, // u8, 0 or 1
+	MSI_EC_ATTR_EVENT,        // u32, enum msi_ec_event
+	MSI_EC_ATTR_VALUE,        // u32, new value
+	MSI_EC_ATTR_FIELD,        // u32, enum msi_ec_field_id
+	MSI_EC_ATTR_OLD_VALUE,    // u32, value before the change
+	__MSI_EC_ATTR_MAX,
+};
+#define MSI_EC_ATTR_MAX (__MSI_EC_ATTR_MAX - 1)
+
+enum msi_ec_event {
+	MSI_EC_EVENT_UNSPEC,
+	MSI_EC_EVENT_FIELD,      // value: new value, with FIELD and OLD_VALUE
+	MSI_EC_EVENT_HOTKEY,     // value: input key code
+	MSI_EC_EVENT_TEMP_ABOVE, // value: enum msi_ec_sensor, with a SENSOR
+	MSI_EC_EVENT_TEMP_BELOW, // value: enum msi_ec_sensor, with a SENSOR
+};
+
+#endif // __MSI_EC_UAPI__